@@ -0,0 +1,144 @@
+#include "Animation.h"
+#include "MeshCache.h"
+#include "MeshWriter.h"
+#include "SceneGraph.h"
+#include "Stats.h"
+#include "VoxReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+static void visitFrames(std::vector<int>& keyframes, VoxReader& reader, int nodeId, std::unordered_set<int>& visited)
+{
+    // a node reached twice is not a tree, flattenFrame reports it
+    if (!visited.insert(nodeId).second)
+        return;
+
+    // the first key of a node holds from frame 0
+    if (const VoxTransform* node = reader.getTransform(nodeId)) {
+        if (node->hidden)
+            return;
+        for (int i = 1; i < node->numFrames; i++)
+            keyframes.push_back(node->frames[i].index);
+        visitFrames(keyframes, reader, node->childNodeId, visited);
+    } else if (const VoxGroup* node = reader.getGroup(nodeId)) {
+        if (node->hidden)
+            return;
+        for (int i = 0; i < node->numChildren; i++)
+            visitFrames(keyframes, reader, node->children[i], visited);
+    } else if (const VoxShape* node = reader.getShape(nodeId)) {
+        if (node->hidden)
+            return;
+        for (int i = 1; i < node->numModels; i++)
+            keyframes.push_back(node->models[i].frame);
+    }
+}
+
+void listKeyframes(std::vector<int>& keyframes, VoxReader& reader)
+{
+    keyframes.clear();
+    if (reader.getNumNodes() == 0) {
+        for (int i = 0; i < reader.getNumModels(); i++)
+            keyframes.push_back(i);
+        return;
+    }
+
+    keyframes.push_back(0);
+    std::unordered_set<int> visited;
+    visitFrames(keyframes, reader, 0, visited);
+    std::sort(keyframes.begin(), keyframes.end());
+    keyframes.erase(std::unique(keyframes.begin(), keyframes.end()), keyframes.end());
+    keyframes.erase(keyframes.begin(), std::lower_bound(keyframes.begin(), keyframes.end(), 0));
+}
+
+static bool sameSize(const VoxModelInfo& a, const VoxModelInfo& b)
+{
+    return a.sizeX == b.sizeX && a.sizeY == b.sizeY && a.sizeZ == b.sizeZ;
+}
+
+void findDuplicateModels(std::vector<int>& canonical, const VoxReader& reader)
+{
+    canonical.resize(reader.getNumModels());
+    std::unordered_map<uint64_t, std::vector<int>> models;
+    for (int i = 0; i < reader.getNumModels(); i++) {
+        const VoxModelInfo& info = reader.getModelInfo(i);
+        const VoxChunk& chunk = reader.getChunks()[info.chunk];
+        const uint8_t* content = reader.getChunkContent(chunk);
+        uint64_t seed = ((uint64_t)info.sizeX << 40) ^ ((uint64_t)info.sizeY << 20) ^ info.sizeZ;
+        canonical[i] = i;
+
+        // the bytes are compared too, a collision is not a duplicate
+        std::vector<int>& same = models[hashBytes(content, chunk.size, seed)];
+        for (int other : same) {
+            const VoxModelInfo& otherInfo = reader.getModelInfo(other);
+            const VoxChunk& otherChunk = reader.getChunks()[otherInfo.chunk];
+            if (sameSize(otherInfo, info) && otherChunk.size == chunk.size &&
+                memcmp(reader.getChunkContent(otherChunk), content, chunk.size) == 0) {
+                canonical[i] = other;
+                break;
+            }
+        }
+        if (canonical[i] == i)
+            same.push_back(i);
+    }
+}
+
+bool convertFrames(VoxReader& reader, MeshWriter& writer, const PolygonizeOptions& options, bool bake, int frameRate)
+{
+    std::vector<int> keyframes;
+    std::vector<std::vector<VoxInstance>> frames;
+    std::vector<VoxInstance> instances;
+    {
+        StageTimer timer(options.stats, STAGE_PARSE);
+        std::vector<int> canonical;
+        findDuplicateModels(canonical, reader);
+        listKeyframes(keyframes, reader);
+        frames.resize(keyframes.size());
+        for (size_t f = 0; f < frames.size(); f++) {
+            if (!flattenFrame(frames[f], reader, keyframes[f]))
+                return false;
+            for (VoxInstance& instance : frames[f])
+                instance.model = canonical[instance.model];
+            instances.insert(instances.end(), frames[f].begin(), frames[f].end());
+        }
+    }
+
+    std::vector<VoxelGroup> meshes;
+    bool converted = polygonizeInstances(meshes, reader, instances, options);
+
+    // instanced meshes are added once and placed in every frame showing them
+    StageTimer timer(options.stats, STAGE_WRITE);
+    bool instancing = !bake && writer.supportsInstancing();
+    std::vector<int> meshIndexes(meshes.size(), -2);
+    for (size_t f = 0; f < frames.size(); f++) {
+        // a keyframe is shown until the next one, the last one for a frame
+        float end = f + 1 < frames.size() ? (float)keyframes[f + 1] : (float)keyframes[f] + 1;
+        std::string name = "frame_" + std::to_string(keyframes[f]);
+        if (writer.supportsAnimation())
+            writer.beginFrame(name, (float)keyframes[f] / frameRate, end / frameRate);
+
+        if (!instancing) {
+            VoxelGroup world;
+            for (const VoxInstance& instance : frames[f])
+                bakeInstance(world, meshes[instance.model], instance);
+            converted = writer.write(world, name) && converted;
+            continue;
+        }
+
+        for (const VoxInstance& instance : frames[f]) {
+            int& mesh = meshIndexes[instance.model];
+            if (mesh == -2)
+                mesh = writer.addMesh(meshes[instance.model], "model_" + std::to_string(instance.model));
+            if (mesh < 0)
+                continue;
+
+            float matrix[16];
+            instanceMatrix(matrix, instance);
+            if (!writer.addInstance(mesh, matrix, instance.name))
+                return false;
+        }
+    }
+    return converted;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <vector>
+
+class MeshWriter;
+class VoxReader;
+
+// Frames at which a visible node of the scene changes, in order from frame 0.
+// Only these frames are converted, each held until the next one. Files
+// without nodes store one frame per model.
+void listKeyframes(std::vector<int>& keyframes, VoxReader& reader);
+
+// Maps each model to the first model with the same size and voxels, found by a hash
+// of their XYZI chunks, itself for the first one. Animations hold a pose over
+// many frames with a model per frame.
+void findDuplicateModels(std::vector<int>& canonical, const VoxReader& reader);
+
+// Converts every animation frame of the scene, meshing the models of all
+// frames once with duplicates merged. The keyframe at frame N is named
+// frame_N and shown from N / frameRate seconds until the next keyframe, for
+// 1 / frameRate seconds for the last one, by writers with animation, written
+// as the next mesh by the others. Returns false when the file has a
+// malformed chunk, a model failed to decode or a write failed.
+bool convertFrames(VoxReader& reader, MeshWriter& writer, const PolygonizeOptions& options, bool bake,
+                   int frameRate);
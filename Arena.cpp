@@ -0,0 +1,59 @@
+#include "Arena.h"
+
+#include <cstdlib>
+
+static const size_t FirstBlockSize = 4096;
+
+Arena::Arena(Arena&& other)
+    : _block(other._block)
+    , _used(other._used)
+{
+    other._block = nullptr;
+    other._used = 0;
+}
+
+Arena& Arena::operator=(Arena&& other)
+{
+    if (this != &other) {
+        clear();
+        _block = other._block;
+        _used = other._used;
+        other._block = nullptr;
+        other._used = 0;
+    }
+    return *this;
+}
+
+void* Arena::allocateBytes(size_t size, size_t alignment)
+{
+    // the block header keeps the data after it aligned for any type
+    size_t header = (sizeof(Block) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    size_t offset = (_used + alignment - 1) & ~(alignment - 1);
+    if (!_block || offset > _block->size || size > _block->size - offset) {
+        // the doubling below must not wrap
+        if (size > ((size_t)-1 - header) / 2)
+            throw std::bad_alloc();
+        size_t blockSize = _block ? _block->size * 2 : FirstBlockSize;
+        while (blockSize < size)
+            blockSize *= 2;
+        Block* block = static_cast<Block*>(malloc(header + blockSize));
+        if (!block)
+            throw std::bad_alloc();
+        block->previous = _block;
+        block->size = blockSize;
+        _block = block;
+        offset = 0;
+    }
+    _used = offset + size;
+    return reinterpret_cast<char*>(_block) + header + offset;
+}
+
+void Arena::clear()
+{
+    while (_block) {
+        Block* previous = _block->previous;
+        free(_block);
+        _block = previous;
+    }
+    _used = 0;
+}
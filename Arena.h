@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+// Bump allocator for data released all at once. Objects are never destroyed,
+// only trivially destructible types go in it. Memory does not move, pointers
+// stay valid until clear or the destruction of the arena.
+class Arena {
+
+  public:
+    Arena() {}
+    Arena(Arena&& other);
+    Arena& operator=(Arena&& other);
+    ~Arena() { clear(); }
+
+    // uninitialized, null for a count of 0, throws std::bad_alloc when the
+    // size does not fit in a size_t
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        if (count > (size_t)-1 / sizeof(T))
+            throw std::bad_alloc();
+        return count ? static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T))) : nullptr;
+    }
+
+    template <typename T>
+    T* copy(const T* values, size_t count)
+    {
+        T* copied = allocate<T>(count);
+        if (count)
+            memcpy(copied, values, count * sizeof(T));
+        return copied;
+    }
+
+    void* allocateBytes(size_t size, size_t alignment);
+    // frees every block, one free per block, blocks doubling in size
+    void clear();
+
+  private:
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    struct Block {
+        Block* previous;
+        size_t size;
+    };
+
+    Block* _block = nullptr;
+    size_t _used = 0;
+};
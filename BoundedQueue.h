@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Queue between two threads holding at most capacity items: push blocks
+// while it is full and pop while it is empty. Once closed, pop returns false
+// when no item is left.
+template <typename T>
+class BoundedQueue {
+
+  public:
+    explicit BoundedQueue(size_t capacity)
+        : _capacity(capacity)
+        , _closed(false)
+    {}
+
+    void push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this] { return _items.size() < _capacity; });
+        _items.push_back(std::move(item));
+        _notEmpty.notify_one();
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this] { return !_items.empty() || _closed; });
+        if (_items.empty())
+            return false;
+
+        item = std::move(_items.front());
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notEmpty.notify_all();
+    }
+
+  private:
+    size_t _capacity;
+    bool _closed;
+    std::deque<T> _items;
+    std::mutex _mutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "polygonize.h"
+
+// Coordinates of the cubic chunks of ChunkedMesh and of the world meshing, a
+// voxel at position p being in chunk floorDiv(p, chunkSize) on each axis
+
+inline int floorDiv(int value, int divisor)
+{
+    return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+// Chunk coordinate packed as 21 bits per axis
+inline uint64_t chunkKey(const ivec3& coord)
+{
+    const int bias = 1 << 20;
+    return ((uint64_t)(coord[0] + bias) << 42) | ((uint64_t)(coord[1] + bias) << 21) | (uint64_t)(coord[2] + bias);
+}
+
+// x first, then y and z
+inline bool lessCoord(const ivec3& a, const ivec3& b)
+{
+    return std::lexicographical_compare(a.v, a.v + 3, b.v, b.v + 3);
+}
+
+// Step from a chunk to the neighbour i of the 27 around it, -1, 0 or 1 per
+// axis, z varying fastest. Neighbour 13 is the chunk itself.
+inline ivec3 neighbourStep(int i) { return ivec3(i / 9 - 1, i / 3 % 3 - 1, i % 3 - 1); }
@@ -0,0 +1,213 @@
+#include "ChunkedMesh.h"
+#include "ChunkCoord.h"
+#include "ThreadPool.h"
+#include "VoxelGrid.h"
+
+#include <algorithm>
+
+ChunkedMesh::ChunkedMesh(int chunkSize, const PolygonizeOptions& options)
+    : _chunkSize(chunkSize)
+    , _options(options)
+    , _threadPool(options.threadPool)
+{
+    // chunks are small, they are meshed in parallel rather than by slabs,
+    // and the cache is keyed by whole models
+    _options.threadPool = nullptr;
+    _options.cache = nullptr;
+    _options.stats = nullptr;
+}
+
+ivec3 ChunkedMesh::chunkCoord(const ivec3& position) const
+{
+    return ivec3(floorDiv(position[0], _chunkSize), floorDiv(position[1], _chunkSize),
+                 floorDiv(position[2], _chunkSize));
+}
+
+int ChunkedMesh::voxelIndex(const ivec3& position, const ivec3& coord) const
+{
+    int x = position[0] - coord[0] * _chunkSize;
+    int y = position[1] - coord[1] * _chunkSize;
+    int z = position[2] - coord[2] * _chunkSize;
+    return (x * _chunkSize + y) * _chunkSize + z;
+}
+
+const ChunkedMesh::Chunk* ChunkedMesh::findChunk(const ivec3& coord) const
+{
+    std::unordered_map<uint64_t, Chunk>::const_iterator it = _chunks.find(chunkKey(coord));
+    return it == _chunks.end() ? nullptr : &it->second;
+}
+
+void ChunkedMesh::markDirty(const ivec3& coord)
+{
+    std::unordered_map<uint64_t, Chunk>::iterator it = _chunks.find(chunkKey(coord));
+    if (it == _chunks.end() || it->second.dirty)
+        return;
+    it->second.dirty = true;
+    _dirty.push_back(coord);
+}
+
+void ChunkedMesh::setVoxel(const ivec3& position, MaterialID material)
+{
+    // edits come in strokes, the chunk of the previous one is looked up first
+    ivec3 coord = chunkCoord(position);
+    uint64_t key = chunkKey(coord);
+    if (!_lastChunk || _lastKey != key) {
+        std::unordered_map<uint64_t, Chunk>::iterator it = _chunks.find(key);
+        if (it == _chunks.end()) {
+            if (!material)
+                return;
+            it = _chunks.insert(std::make_pair(key, Chunk())).first;
+            it->second.coord = coord;
+            it->second.voxels.assign((size_t)_chunkSize * _chunkSize * _chunkSize, 0);
+        }
+        _lastKey = key;
+        _lastChunk = &it->second;
+    }
+
+    Chunk& chunk = *_lastChunk;
+    MaterialID& voxel = chunk.voxels[voxelIndex(position, coord)];
+    if (voxel == material)
+        return;
+    chunk.numVoxels += (material != 0) - (voxel != 0);
+    voxel = material;
+    if (!chunk.dirty) {
+        chunk.dirty = true;
+        _dirty.push_back(coord);
+    }
+
+    // Neighbours get dirty when the voxel is on their side of the chunk, the
+    // faces of their voxels against it change. Occlusion also reads the
+    // voxels along the edges and corners of the chunk.
+    int local[3];
+    bool boundary = false;
+    for (int axis = 0; axis < 3; axis++) {
+        local[axis] = position[axis] - coord[axis] * _chunkSize;
+        boundary = boundary || local[axis] == 0 || local[axis] == _chunkSize - 1;
+    }
+    if (!boundary)
+        return;
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dz = -1; dz <= 1; dz++) {
+                int step[3] = {dx, dy, dz};
+                int numSteps = (dx != 0) + (dy != 0) + (dz != 0);
+                if (!numSteps || (numSteps > 1 && !_options.occlusion))
+                    continue;
+                bool touches = true;
+                for (int axis = 0; axis < 3; axis++) {
+                    if (step[axis] < 0)
+                        touches = touches && local[axis] == 0;
+                    else if (step[axis] > 0)
+                        touches = touches && local[axis] == _chunkSize - 1;
+                }
+                if (touches)
+                    markDirty(ivec3(coord[0] + dx, coord[1] + dy, coord[2] + dz));
+            }
+        }
+    }
+}
+
+void ChunkedMesh::setVoxels(const VoxModel& model, const ivec3& offset)
+{
+    for (const VoxelPos& voxel : model)
+        setVoxel(ivec3(voxel[0] + offset[0], voxel[1] + offset[1], voxel[2] + offset[2]), voxel[3]);
+}
+
+MaterialID ChunkedMesh::getVoxel(const ivec3& position) const
+{
+    ivec3 coord = chunkCoord(position);
+    const Chunk* chunk = findChunk(coord);
+    return chunk ? chunk->voxels[voxelIndex(position, coord)] : 0;
+}
+
+// Meshes a chunk in a grid with a one voxel apron taken from the 26
+// neighbours, the apron hides faces and darkens corners without being meshed
+void ChunkedMesh::polygonizeChunk(Chunk& chunk) const
+{
+    const Chunk* around[27];
+    for (int i = 0; i < 27; i++)
+        around[i] = i == 13 ? &chunk : findChunk(chunk.coord + neighbourStep(i));
+
+    int size = _chunkSize + 2;
+    VoxelGrid grid;
+    for (int axis = 0; axis < 3; axis++)
+        grid.size[axis] = size;
+    grid.wordsPerRow = (size + 63) / 64;
+    grid.occupancy.assign((size_t)size * size * grid.wordsPerRow, 0);
+    grid.materials.assign((size_t)size * size * size, 0);
+
+    // neighbour along an axis of a grid coordinate, and its coordinate in it
+    std::vector<int> side(size);
+    std::vector<int> local(size);
+    for (int i = 0; i < size; i++) {
+        side[i] = i == 0 ? 0 : i == size - 1 ? 2 : 1;
+        local[i] = (i - 1 + _chunkSize) % _chunkSize;
+    }
+
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            int rowId = grid.rowIndex(x, y);
+            for (int z = 0; z < size; z++) {
+                const Chunk* source = around[side[x] * 9 + side[y] * 3 + side[z]];
+                if (!source)
+                    continue;
+                MaterialID material = source->voxels[(local[x] * _chunkSize + local[y]) * _chunkSize + local[z]];
+                if (!material)
+                    continue;
+                grid.occupancy[(size_t)rowId * grid.wordsPerRow + (z >> 6)] |= uint64_t(1) << (z & 63);
+                grid.materials[(size_t)rowId * size + z] = material;
+            }
+        }
+    }
+
+    // meshed at the chunk origin, then moved to the chunk like the world
+    // chunks, far chunks leave the compact storage rather than wrap
+    chunk.mesh.clear();
+    polygonize(chunk.mesh, grid, ivec3(1, 1, 1), ivec3(size - 1, size - 1, size - 1), _options);
+    ivec3 offset;
+    for (int axis = 0; axis < 3; axis++)
+        offset[axis] = chunk.coord[axis] * _chunkSize - 1;
+    for (VoxelGroup::iterator it = chunk.mesh.begin(); it != chunk.mesh.end(); it++)
+        it->second.translate(offset);
+}
+
+void ChunkedMesh::update(std::vector<ivec3>& changed)
+{
+    changed.clear();
+    std::sort(_dirty.begin(), _dirty.end(), lessCoord);
+    changed.swap(_dirty);
+
+    std::vector<Chunk*> chunks(changed.size());
+    for (size_t i = 0; i < changed.size(); i++)
+        chunks[i] = &_chunks[chunkKey(changed[i])];
+
+    auto remesh = [&](int i) {
+        chunks[i]->dirty = false;
+        if (chunks[i]->numVoxels)
+            polygonizeChunk(*chunks[i]);
+    };
+    parallelFor(_threadPool, chunks.size(), remesh);
+
+    // emptied chunks go once every neighbour has read them
+    for (Chunk* chunk : chunks) {
+        if (!chunk->numVoxels) {
+            if (chunk == _lastChunk)
+                _lastChunk = nullptr;
+            _chunks.erase(chunkKey(chunk->coord));
+        }
+    }
+}
+
+const VoxelGroup* ChunkedMesh::getMesh(const ivec3& coord) const
+{
+    const Chunk* chunk = findChunk(coord);
+    return chunk ? &chunk->mesh : nullptr;
+}
+
+void ChunkedMesh::getChunks(std::vector<ivec3>& coords) const
+{
+    coords.clear();
+    for (std::unordered_map<uint64_t, Chunk>::const_iterator it = _chunks.begin(); it != _chunks.end(); it++)
+        coords.push_back(it->second.coord);
+    std::sort(coords.begin(), coords.end(), lessCoord);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Mesh of a model kept up to date under edits. Voxels are stored in cubic
+// chunks of chunkSize, each with its own VoxelGroup. Edits only mark the chunk
+// of the voxel dirty, and the neighbours whose faces it touches, so update
+// remeshes in proportion to the edit rather than to the model. Voxel
+// coordinates are any int, vertexes are in those coordinates.
+class ChunkedMesh {
+
+  public:
+    // options are the ones of every chunk, its thread pool meshes the dirty
+    // chunks in parallel
+    explicit ChunkedMesh(int chunkSize = 32, const PolygonizeOptions& options = PolygonizeOptions());
+
+    int chunkSize() const { return _chunkSize; }
+
+    // material 0 clears the voxel
+    void setVoxel(const ivec3& position, MaterialID material);
+    void clearVoxel(const ivec3& position) { setVoxel(position, 0); }
+    // sets every voxel of model, its positions moved by offset
+    void setVoxels(const VoxModel& model, const ivec3& offset = ivec3(0, 0, 0));
+    MaterialID getVoxel(const ivec3& position) const;
+
+    // Remeshes the dirty chunks and returns their coordinates in changed,
+    // sorted. A chunk left without voxels is removed, its mesh with it.
+    void update(std::vector<ivec3>& changed);
+    bool hasDirtyChunks() const { return !_dirty.empty(); }
+
+    // mesh of the chunk at coord, null when it has no voxels
+    const VoxelGroup* getMesh(const ivec3& coord) const;
+    // coordinates of every chunk with voxels, sorted
+    void getChunks(std::vector<ivec3>& coords) const;
+
+  private:
+    struct Chunk {
+        ivec3 coord;
+        // chunkSize^3 materials, 0 when empty, in the x, y, z order of VoxelGrid
+        std::vector<MaterialID> voxels;
+        int numVoxels = 0;
+        bool dirty = false;
+        VoxelGroup mesh;
+    };
+
+    ivec3 chunkCoord(const ivec3& position) const;
+    int voxelIndex(const ivec3& position, const ivec3& coord) const;
+    const Chunk* findChunk(const ivec3& coord) const;
+    void markDirty(const ivec3& coord);
+    void polygonizeChunk(Chunk& chunk) const;
+
+    int _chunkSize;
+    PolygonizeOptions _options;
+    ThreadPool* _threadPool;
+    std::unordered_map<uint64_t, Chunk> _chunks;
+    std::vector<ivec3> _dirty;
+    // chunk of the last edit, elements of _chunks do not move
+    uint64_t _lastKey = 0;
+    Chunk* _lastChunk = nullptr;
+};
@@ -0,0 +1,327 @@
+#include "Convert.h"
+#include "Animation.h"
+#include "FileSystem.h"
+#include "Lod.h"
+#include "Log.h"
+#include "MeshCache.h"
+#include "MeshWriter.h"
+#include "Pipeline.h"
+#include "SceneGraph.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "VoxReader.h"
+#include "World.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <dirent.h>
+#include <exception>
+#include <glob.h>
+#include <memory>
+#include <set>
+#include <strings.h>
+
+static bool isSingleModel(const ConvertOptions& options)
+{
+    bool lods = !options.world && options.lods > 1;
+    return !options.world && (lods || (!options.pipeline && options.frameRate <= 0)) && options.model >= 0;
+}
+
+static bool hasModel(const VoxReader& reader, const ConvertOptions& options, const char* inputName)
+{
+    if (isSingleModel(options) && options.model >= reader.getNumModels()) {
+        logMessage(LOG_ERROR, "no model %d in %s\n", options.model, inputName);
+        return false;
+    }
+    return true;
+}
+
+// the format follows output, a path or an extension, obj by default
+static MeshWriter* createWriter(VoxReader& reader, const char* output, const ConvertOptions& options)
+{
+    MeshWriter* writer = createMeshWriter(output, options.polygonize.threadPool, options.triangles);
+    if (options.polygonize.atlas) {
+        Palette palette;
+        readPalette(palette, reader);
+        writer->setPalette(palette);
+    }
+    return writer;
+}
+
+// Meshes and writes the scene with writer, opened already, and closes it
+static bool convertScene(VoxReader& reader, MeshWriter& writer, const ConvertOptions& options)
+{
+    Stats* stats = options.polygonize.stats;
+    bool lods = !options.world && options.lods > 1;
+    bool singleModel = isSingleModel(options);
+
+    bool converted;
+    if (options.world) {
+        converted = convertWorld(reader, writer, options.polygonize);
+    } else if (lods) {
+        std::vector<int> models;
+        for (int i = 0; i < reader.getNumModels(); i++) {
+            if (!singleModel || i == options.model)
+                models.push_back(i);
+        }
+        converted = convertLods(reader, writer, models, options.lods, options.polygonize);
+    } else if (options.frameRate > 0) {
+        converted = convertFrames(reader, writer, options.polygonize, options.bake, options.frameRate);
+    } else if (options.pipeline) {
+        converted = convertPipelined(reader, writer, options.polygonize);
+    } else if (singleModel) {
+        // only the bytes of the converted model are decoded
+        std::vector<VoxelGroup> meshes;
+        converted = polygonizeModels(meshes, reader, std::vector<int>(1, options.model), options.polygonize);
+        StageTimer timer(stats, STAGE_WRITE);
+        converted = writer.write(meshes[options.model], std::string()) && converted;
+    } else {
+        // models shared by several shapes are meshed once
+        std::vector<VoxInstance> instances;
+        {
+            StageTimer timer(stats, STAGE_PARSE);
+            converted = flattenScene(instances, reader);
+        }
+        std::vector<VoxelGroup> meshes;
+        converted = converted && polygonizeInstances(meshes, reader, instances, options.polygonize);
+        StageTimer timer(stats, STAGE_WRITE);
+        converted = converted && writeScene(writer, meshes, instances, options.bake);
+    }
+
+    // chunks decoded on access, materials or nodes, may be malformed
+    StageTimer timer(stats, STAGE_WRITE);
+    return writer.close() && converted && !reader.failed();
+}
+
+static bool convert(const char* inputFile, const char* outputFile, const ConvertOptions& options)
+{
+    Stats* stats = options.polygonize.stats;
+    VoxReader reader;
+    {
+        StageTimer timer(stats, STAGE_READ);
+        if (!reader.openFile(inputFile)) {
+            logMessage(LOG_ERROR, "error reading voxels\n");
+            return false;
+        }
+    }
+    if (!hasModel(reader, options, inputFile))
+        return false;
+
+    std::unique_ptr<MeshWriter> writer(createWriter(reader, outputFile, options));
+    if (!writer->open(outputFile))
+        return false;
+    bool converted = convertScene(reader, *writer, options);
+    if (stats)
+        stats->addBytesWritten(fileSize(outputFile));
+    return converted;
+}
+
+bool convertFile(const char* inputFile, const char* outputFile, const ConvertOptions& options)
+{
+    if (!options.polygonize.stats)
+        return convert(inputFile, outputFile, options);
+
+    // counters of the file are gathered apart to attribute its models to it
+    Stats fileStats;
+    ConvertOptions fileOptions = options;
+    fileOptions.polygonize.stats = &fileStats;
+    bool converted = convert(inputFile, outputFile, fileOptions);
+    fileStats.addFile(converted);
+    options.polygonize.stats->merge(fileStats, inputFile);
+    return converted;
+}
+
+bool convertData(const uint8_t* bytes, size_t size, OutputBuffer& output, const char* format,
+                 const ConvertOptions& options)
+{
+    Stats* stats = options.polygonize.stats;
+    VoxReader reader;
+    {
+        StageTimer timer(stats, STAGE_READ);
+        if (!reader.indexVoxelsData(bytes, size)) {
+            logMessage(LOG_ERROR, "error reading voxels\n");
+            return false;
+        }
+    }
+    if (!hasModel(reader, options, "the data"))
+        return false;
+
+    std::unique_ptr<MeshWriter> writer(createWriter(reader, format, options));
+    size_t start = output.size;
+    if (!writer->open(output))
+        return false;
+    bool converted = convertScene(reader, *writer, options);
+    if (stats) {
+        stats->addBytesWritten(output.size - start);
+        stats->addFile(converted);
+    }
+    return converted;
+}
+
+static bool hasVoxExtension(const std::string& path)
+{
+    return path.size() >= 4 && strcasecmp(path.c_str() + path.size() - 4, ".vox") == 0;
+}
+
+static bool listDirectory(std::vector<std::string>& files, const std::string& path)
+{
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        logMessage(LOG_ERROR, "Failed to open directory %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<std::string> entries;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string file = path + "/" + entry->d_name;
+        if (hasVoxExtension(file) && !isDirectory(file))
+            entries.push_back(file);
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    files.insert(files.end(), entries.begin(), entries.end());
+    return true;
+}
+
+static bool readManifest(std::vector<std::string>& inputs, const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        logMessage(LOG_ERROR, "Failed to open %s\n", path.c_str());
+        return false;
+    }
+
+    // one input per line, empty lines and lines starting with # are skipped
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        size_t length = strlen(line);
+        while (length && (line[length - 1] == '\n' || line[length - 1] == '\r' || line[length - 1] == ' '))
+            line[--length] = 0;
+        if (length && line[0] != '#')
+            inputs.push_back(line);
+    }
+    fclose(fp);
+    return true;
+}
+
+bool collectBatchFiles(std::vector<std::string>& files, const std::vector<std::string>& inputs)
+{
+    bool found = true;
+    for (const std::string& input : inputs) {
+        if (input.find_first_of("*?[") != std::string::npos) {
+            glob_t matches;
+            if (glob(input.c_str(), 0, nullptr, &matches) != 0) {
+                logMessage(LOG_ERROR, "no file matches %s\n", input.c_str());
+                found = false;
+                continue;
+            }
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                if (!isDirectory(matches.gl_pathv[i]))
+                    files.push_back(matches.gl_pathv[i]);
+            }
+            globfree(&matches);
+        } else if (isDirectory(input)) {
+            found = listDirectory(files, input) && found;
+        } else if (hasVoxExtension(input)) {
+            files.push_back(input);
+        } else {
+            // entries of a manifest are not manifests themselves
+            std::vector<std::string> listed;
+            found = readManifest(listed, input) && found;
+            for (const std::string& entry : listed) {
+                if (isDirectory(entry)) {
+                    found = listDirectory(files, entry) && found;
+                } else {
+                    files.push_back(entry);
+                }
+            }
+        }
+    }
+
+    // an input named twice is converted once
+    std::set<std::string> seen;
+    std::vector<std::string> unique;
+    for (const std::string& file : files) {
+        if (seen.insert(file).second)
+            unique.push_back(file);
+    }
+    files.swap(unique);
+    return found;
+}
+
+static std::string outputPath(const std::string& inputFile, const char* outputDir, const char* extension)
+{
+    size_t slash = inputFile.find_last_of('/');
+    std::string name = slash == std::string::npos ? inputFile : inputFile.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0)
+        name.resize(dot);
+    return std::string(outputDir) + "/" + name + "." + extension;
+}
+
+int convertBatch(const std::vector<std::string>& files, const char* outputDir, const char* extension,
+                 const ConvertOptions& options)
+{
+    // largest files first so that a big file does not start last and keep
+    // the other threads waiting at the end of the batch
+    std::vector<std::pair<int64_t, int>> order;
+    for (size_t i = 0; i < files.size(); i++)
+        order.push_back(std::make_pair(-(int64_t)fileSize(files[i]), (int)i));
+    std::sort(order.begin(), order.end());
+
+    // inputs with the same name in different directories would write the same output
+    std::vector<std::string> outputFiles(files.size());
+    std::set<std::string> outputs;
+    for (size_t i = 0; i < order.size(); i++) {
+        std::string& outputFile = outputFiles[order[i].second];
+        outputFile = outputPath(files[order[i].second], outputDir, extension);
+        if (!outputs.insert(outputFile).second)
+            outputFile.clear();
+    }
+
+    std::atomic<int> next(0);
+    std::atomic<int> failures(0);
+    std::function<void(int)> convertFiles = [&](int) {
+        for (int i = next++; i < (int)order.size(); i = next++) {
+            const std::string& inputFile = files[order[i].second];
+            const std::string& outputFile = outputFiles[order[i].second];
+            if (outputFile.empty()) {
+                failures++;
+                if (options.polygonize.stats)
+                    options.polygonize.stats->addFile(false);
+                logMessage(LOG_ERROR, "FAILED %s, an input with the same name is converted already\n",
+                           inputFile.c_str());
+                continue;
+            }
+
+            // malformed files fail in the reader, an exception, like running
+            // out of memory on a huge model, fails its file alone too: the
+            // pool rethrows it in the thread converting the file
+            bool converted = false;
+            try {
+                converted = convertFile(inputFile.c_str(), outputFile.c_str(), options);
+            } catch (const std::exception& error) {
+                logMessage(LOG_ERROR, "error converting %s: %s\n", inputFile.c_str(), error.what());
+            }
+
+            if (!converted)
+                failures++;
+            logMessage(converted ? LOG_INFO : LOG_ERROR, "%s %s -> %s\n", converted ? "ok" : "FAILED",
+                       inputFile.c_str(), outputFile.c_str());
+        }
+    };
+
+    // each thread of the pool takes the next largest file, meshing tasks of
+    // the files are then stolen by threads that ran out of files
+    ThreadPool* threadPool = options.polygonize.threadPool;
+    if (threadPool) {
+        threadPool->parallelFor(threadPool->size(), convertFiles);
+    } else {
+        convertFiles(0);
+    }
+
+    logMessage(LOG_INFO, "%d files converted, %d failed\n", (int)files.size() - failures, (int)failures);
+    return failures;
+}
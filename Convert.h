@@ -0,0 +1,52 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct OutputBuffer;
+
+struct ConvertOptions {
+    // convert this model alone in its own coordinates, the scene when negative
+    int model = -1;
+    // bake scene instances into one mesh even when the format has instancing
+    bool bake = false;
+    // convert every model with decoding, meshing and writing overlapped
+    bool pipeline = false;
+    // mesh the scene as one world in chunks, culling faces between models,
+    // model, bake and pipeline are ignored
+    bool world = false;
+    // write triangles ordered for the vertex cache instead of quads
+    bool triangles = false;
+    // convert each model, or the one of model, to this many levels of detail
+    // in its own coordinates when above 1, bake and pipeline are ignored
+    int lods = 1;
+    // convert every animation frame of the scene, shown this many times a
+    // second by glTF, when above 0, model and pipeline are ignored
+    int frameRate = 0;
+    // its thread pool also formats the obj output when set
+    PolygonizeOptions polygonize;
+};
+
+// Converts inputFile to outputFile, the format following the extension of
+// outputFile. Errors are logged and reported by returning false.
+bool convertFile(const char* inputFile, const char* outputFile, const ConvertOptions& options);
+
+// Converts the vox file in bytes, owned by the caller, appending the output to
+// the content of output. format is an extension, glb or obj. Nothing is copied
+// from bytes but the decoded models.
+bool convertData(const uint8_t* bytes, size_t size, OutputBuffer& output, const char* format,
+                 const ConvertOptions& options);
+
+// Expands inputs into the list of files to convert: directories give the .vox
+// files they contain, patterns with * ? or [ are globbed, .vox files are kept
+// and any other file is a manifest listing one input per line.
+bool collectBatchFiles(std::vector<std::string>& files, const std::vector<std::string>& inputs);
+
+// Converts every file into outputDir with the given extension, largest file
+// first. A failed file is reported and the batch goes on. Returns the number
+// of failed files.
+int convertBatch(const std::vector<std::string>& files, const char* outputDir, const char* extension,
+                 const ConvertOptions& options);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+bool isDirectory(const std::string& path);
+// 0 when the file cannot be read
+uint64_t fileSize(const std::string& path);
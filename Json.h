@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// str as the content of a JSON string, quotes, backslashes and control
+// characters escaped
+std::string escapeJSON(const std::string& str);
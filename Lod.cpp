@@ -0,0 +1,170 @@
+#include "Lod.h"
+#include "Log.h"
+#include "MeshWriter.h"
+#include "Stats.h"
+#include "VoxReader.h"
+#include "VoxelGrid.h"
+
+#include <algorithm>
+
+static inline int floorHalf(int value) { return value >= 0 ? value / 2 : -((-value + 1) / 2); }
+
+void downsampleGrid(VoxelGrid& coarse, const VoxelGrid& fine)
+{
+    coarse.occupancy.clear();
+    coarse.materials.clear();
+    coarse.wordsPerRow = 0;
+    if (fine.empty())
+        return;
+
+    for (int axis = 0; axis < 3; axis++) {
+        coarse.min[axis] = floorHalf(fine.min[axis]);
+        coarse.size[axis] = floorHalf(fine.min[axis] + fine.size[axis] - 1) - coarse.min[axis] + 1;
+    }
+    coarse.wordsPerRow = (coarse.size[2] + 63) / 64;
+    coarse.occupancy.assign((size_t)coarse.size[0] * coarse.size[1] * coarse.wordsPerRow, 0);
+    coarse.materials.assign((size_t)coarse.size[0] * coarse.size[1] * coarse.size[2], 0);
+
+    // fine cell of the first corner of each block, relative to fine.min
+    ivec3 origin;
+    for (int axis = 0; axis < 3; axis++)
+        origin[axis] = coarse.min[axis] * 2 - fine.min[axis];
+
+    // union of the fine rows of a block row, to skip the empty blocks
+    std::vector<uint64_t> rows(fine.wordsPerRow);
+    for (int x = 0; x < coarse.size[0]; x++) {
+        for (int y = 0; y < coarse.size[1]; y++) {
+            std::fill(rows.begin(), rows.end(), 0);
+            for (int dx = 0; dx < 2; dx++) {
+                for (int dy = 0; dy < 2; dy++) {
+                    int fx = origin[0] + x * 2 + dx;
+                    int fy = origin[1] + y * 2 + dy;
+                    if (fx < 0 || fx >= fine.size[0] || fy < 0 || fy >= fine.size[1])
+                        continue;
+                    const uint64_t* row = fine.row(fx, fy);
+                    for (int w = 0; w < fine.wordsPerRow; w++)
+                        rows[w] |= row[w];
+                }
+            }
+
+            for (int z = 0; z < coarse.size[2]; z++) {
+                bool any = false;
+                for (int dz = 0; dz < 2; dz++) {
+                    int fz = origin[2] + z * 2 + dz;
+                    any = any || (fz >= 0 && fz < fine.size[2] && ((rows[fz >> 6] >> (fz & 63)) & 1));
+                }
+                if (!any)
+                    continue;
+
+                MaterialID found[8];
+                int count = 0;
+                for (int d = 0; d < 8; d++) {
+                    int fx = origin[0] + x * 2 + (d & 1);
+                    int fy = origin[1] + y * 2 + ((d >> 1) & 1);
+                    int fz = origin[2] + z * 2 + (d >> 2);
+                    if (fx >= 0 && fx < fine.size[0] && fy >= 0 && fy < fine.size[1] && fz >= 0 &&
+                        fz < fine.size[2] && fine.isSolid(fx, fy, fz))
+                        found[count++] = fine.material(fx, fy, fz);
+                }
+                if (count < 4)
+                    continue;
+
+                MaterialID material = 0;
+                int best = 0;
+                for (int i = 0; i < count; i++) {
+                    int votes = 0;
+                    for (int j = 0; j < count; j++)
+                        votes += found[j] == found[i];
+                    if (votes > best || (votes == best && found[i] < material)) {
+                        best = votes;
+                        material = found[i];
+                    }
+                }
+
+                int rowId = coarse.rowIndex(x, y);
+                coarse.occupancy[(size_t)rowId * coarse.wordsPerRow + (z >> 6)] |= uint64_t(1) << (z & 63);
+                coarse.materials[(size_t)rowId * coarse.size[2] + z] = material;
+            }
+        }
+    }
+}
+
+void buildPyramid(std::vector<VoxelGrid>& levels, int numLevels)
+{
+    levels.resize(1);
+    while ((int)levels.size() < numLevels && !levels.back().empty()) {
+        const ivec3& size = levels.back().size;
+        if (size[0] == 1 && size[1] == 1 && size[2] == 1)
+            break;
+        levels.push_back(VoxelGrid());
+        downsampleGrid(levels.back(), levels[levels.size() - 2]);
+    }
+}
+
+void scaleLevel(VoxelGroup& group, int level)
+{
+    // lattice corners, position + 0.5, scale with the level
+    int scale = 1 << level;
+    for (VoxelGroup::iterator it = group.begin(); it != group.end(); it++) {
+        for (fvec3& vertex : it->second.vertexes) {
+            for (int axis = 0; axis < 3; axis++)
+                vertex[axis] = (vertex[axis] + 0.5f) * scale - 0.5f;
+        }
+        for (svec3& corner : it->second.corners) {
+            for (int axis = 0; axis < 3; axis++)
+                corner[axis] = (int16_t)(corner[axis] * scale);
+        }
+    }
+}
+
+static uint64_t countSolid(const VoxelGrid& grid)
+{
+    uint64_t count = 0;
+    for (uint64_t word : grid.occupancy)
+        count += countBits(word);
+    return count;
+}
+
+bool convertLods(VoxReader& reader, MeshWriter& writer, const std::vector<int>& models, int numLevels,
+                 const PolygonizeOptions& options)
+{
+    bool converted = true;
+    for (int model : models) {
+        VoxModel voxels;
+        {
+            StageTimer timer(options.stats, STAGE_PARSE);
+            if (!reader.readModel(model, voxels)) {
+                logMessage(LOG_ERROR, "error decoding model %d\n", model);
+                converted = false;
+                continue;
+            }
+        }
+
+        // one occupancy build, every level is meshed from the pyramid
+        std::vector<VoxelGrid> levels(1);
+        std::vector<VoxelGroup> meshes;
+        {
+            StageTimer timer(options.stats, STAGE_MESH);
+            levels[0].build(voxels);
+            VoxModel().swap(voxels);
+            buildPyramid(levels, numLevels);
+            meshes.resize(levels.size());
+            for (size_t level = 0; level < levels.size(); level++) {
+                polygonize(meshes[level], levels[level], ivec3(0, 0, 0), levels[level].size, options);
+                scaleLevel(meshes[level], level);
+            }
+        }
+
+        StageTimer timer(options.stats, STAGE_WRITE);
+        for (size_t level = 0; level < levels.size(); level++) {
+            if (options.stats)
+                options.stats->addMesh(model, countSolid(levels[level]), meshes[level], false, level);
+            if (meshes[level].empty())
+                continue;
+            char name[64];
+            snprintf(name, sizeof(name), "model_%d_lod_%d", model, (int)level);
+            converted = writer.write(meshes[level], name) && converted;
+        }
+    }
+    return converted;
+}
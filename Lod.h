@@ -0,0 +1,29 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <vector>
+
+class MeshWriter;
+class VoxReader;
+struct VoxelGrid;
+
+// Halves a grid: each cell of coarse is a 2x2x2 block of fine aligned on even
+// voxel coordinates. The cell is solid when at least 4 of the 8 are, with the
+// material found the most in them, the lowest one on a tie.
+void downsampleGrid(VoxelGrid& coarse, const VoxelGrid& fine);
+
+// Mip pyramid over levels[0], built by the caller: each next level is the
+// downsampled previous one, up to numLevels levels or a level of one cell
+void buildPyramid(std::vector<VoxelGrid>& levels, int numLevels);
+
+// Moves the mesh of a pyramid level from the voxels of the level to the ones
+// of level 0, both storages
+void scaleLevel(VoxelGroup& group, int level);
+
+// Converts each model, in its own coordinates, to numLevels levels of detail
+// meshed from one pyramid. Level L of model M is written as a mesh named
+// model_M_lod_L. The faces of each level are added to the stats of options.
+// Returns false when a model failed to decode or a write failed.
+bool convertLods(VoxReader& reader, MeshWriter& writer, const std::vector<int>& models, int numLevels,
+                 const PolygonizeOptions& options);
@@ -0,0 +1,46 @@
+#include "Log.h"
+
+#include <cstdarg>
+#include <stdio.h>
+#include <string>
+
+static void logToStderr(LogLevel level, const char* message, void*)
+{
+    if (level == LOG_ERROR)
+        fputs(message, stderr);
+}
+
+static LogCallback logCallback = logToStderr;
+static void* logUser = nullptr;
+
+void setLogCallback(LogCallback callback, void* user)
+{
+    logCallback = callback;
+    logUser = user;
+}
+
+void logMessage(LogLevel level, const char* format, ...)
+{
+    LogCallback callback = logCallback;
+    if (!callback)
+        return;
+
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    if (length < (int)sizeof(text)) {
+        callback(level, text, logUser);
+        return;
+    }
+
+    // long paths in the message
+    std::string message(length + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&message[0], message.size(), format, args);
+    va_end(args);
+    callback(level, message.c_str(), logUser);
+}
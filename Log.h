@@ -0,0 +1,18 @@
+#pragma once
+
+// The library never prints, its messages go through the log callback. Debug
+// messages are only sent by DEBUG builds.
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_ERROR };
+
+// message is one or more lines, each ending with a newline. It is called from
+// any thread, meshing threads included, without a lock.
+typedef void (*LogCallback)(LogLevel level, const char* message, void* user);
+
+// Replaces the callback of the whole process, null drops every message. Errors
+// go to stderr until a callback is set.
+void setLogCallback(LogCallback callback, void* user = nullptr);
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void logMessage(LogLevel level, const char* format, ...);
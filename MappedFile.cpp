@@ -0,0 +1,72 @@
+#include "MappedFile.h"
+
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data != MAP_FAILED) {
+        _data = static_cast<const uint8_t*>(data);
+        _size = info.st_size;
+        _mapped = true;
+        return true;
+    }
+#endif
+
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    if (size <= 0) {
+        fclose(fp);
+        return false;
+    }
+
+    _buffer.resize(size);
+    fseek(fp, 0, SEEK_SET);
+    size_t read = fread(&_buffer[0], size, 1, fp);
+    fclose(fp);
+    if (read != 1) {
+        _buffer.clear();
+        return false;
+    }
+
+    _data = &_buffer[0];
+    _size = size;
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+    if (_mapped)
+        munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+    std::vector<uint8_t>().swap(_buffer);
+    _data = nullptr;
+    _size = 0;
+    _mapped = false;
+}
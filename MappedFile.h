@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Read only view of a whole file. The file is memory mapped where available
+// and read in a buffer otherwise.
+class MappedFile {
+
+  public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool isOpen() const { return _data != nullptr; }
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+  private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+    bool _mapped = false;
+    std::vector<uint8_t> _buffer;
+};
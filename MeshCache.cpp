@@ -0,0 +1,371 @@
+#include "MeshCache.h"
+#include "FileSystem.h"
+#include "Log.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "VoxReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+// Changes whenever the meshes produced for the same input change, so entries
+// of older versions are never loaded
+static const char* MesherVersion = "vox2obj-mesh-4";
+
+static const uint32_t CacheMagic = 0x31434d56; // "VMC1"
+static const char* CacheExtension = ".mesh";
+
+// temporary files left by a process that died are removed after an hour
+static const time_t TempFileLifetime = 3600;
+
+static inline uint64_t mix64(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t hash = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ mix64(word)) * 0x9e3779b97f4a7c15ULL;
+        hash = (hash << 31) | (hash >> 33);
+    }
+
+    if (i < size) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, size - i);
+        hash = (hash ^ mix64(word)) * 0x9e3779b97f4a7c15ULL;
+    }
+    return mix64(hash);
+}
+
+std::string MeshCacheKey::name() const
+{
+    char text[33];
+    snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)hash[0], (unsigned long long)hash[1]);
+    return text;
+}
+
+bool MeshCache::open(const std::string& directory, uint64_t maxBytes)
+{
+    mkdir(directory.c_str(), 0755);
+    if (!isDirectory(directory)) {
+        logMessage(LOG_ERROR, "Failed to create cache directory %s\n", directory.c_str());
+        return false;
+    }
+    _directory = directory;
+    _maxBytes = maxBytes;
+    return true;
+}
+
+MeshCacheKey MeshCache::modelKey(const VoxReader& reader, int model, const PolygonizeOptions& options)
+{
+    MeshCacheKey key;
+    key.hash[0] = 0;
+    key.hash[1] = 0x2545f4914f6cdd1dULL;
+
+    // every input goes through both hashes, seeded differently
+    auto add = [&key](const void* data, size_t size) {
+        key.hash[0] = hashBytes(data, size, key.hash[0]);
+        key.hash[1] = hashBytes(data, size, key.hash[1]);
+    };
+
+    add(MesherVersion, strlen(MesherVersion));
+    // options changing the mesh, new ones have to be added here
+    uint8_t flags[5] = {options.greedy, options.weld, options.compact, options.atlas, options.occlusion};
+    add(flags, sizeof(flags));
+
+    uint32_t rgba, matl;
+    memcpy(&rgba, "RGBA", 4);
+    memcpy(&matl, "MATL", 4);
+    for (const VoxChunk& chunk : reader.getChunks()) {
+        if (chunk.id == rgba || chunk.id == matl)
+            add(reader.getChunkContent(chunk), chunk.size);
+    }
+
+    const VoxChunk& chunk = reader.getChunks()[reader.getModelInfo(model).chunk];
+    add(reader.getChunkContent(chunk), chunk.size);
+    return key;
+}
+
+std::string MeshCache::path(const MeshCacheKey& key) const { return _directory + "/" + key.name() + CacheExtension; }
+
+// Entry layout: magic, key, number of buffers then for each buffer its
+// material, its storage flags, its 9 array sizes and the arrays as stored in
+// VoxelBuffer
+template <typename T>
+static bool readArray(std::vector<T>& array, uint32_t count, const uint8_t*& cursor, const uint8_t* end)
+{
+    if ((size_t)(end - cursor) / sizeof(T) < count)
+        return false;
+    array.resize(count);
+    if (count)
+        memcpy(&array[0], cursor, count * sizeof(T));
+    cursor += count * sizeof(T);
+    return true;
+}
+
+template <typename T>
+static bool indexesBelow(const std::vector<T>& indexes, size_t count)
+{
+    for (T index : indexes) {
+        if (index >= count)
+            return false;
+    }
+    return true;
+}
+
+// The invariants the writers rely on, an entry breaking one would have them
+// read out of the arrays
+static bool validBuffer(const VoxelBuffer& buffer)
+{
+    size_t numVertexes = buffer.numVertexes();
+    size_t numFaces = buffer.numFaces();
+    if (!buffer.compact) {
+        if (!buffer.corners.empty() || !buffer.quads16.empty() || !buffer.quads32.empty())
+            return false;
+        if (!buffer.normals.empty() && buffer.normals.size() != numVertexes)
+            return false;
+        if (!buffer.faceNormals.empty() && buffer.faceNormals.size() != numFaces)
+            return false;
+        for (const Face& face : buffer.faces) {
+            for (int j = 0; j < 4; j++) {
+                if (face[j] < 0 || (size_t)face[j] >= numVertexes)
+                    return false;
+            }
+        }
+    } else {
+        // quads are 32 bits past 65536 corners, 16 bits otherwise
+        bool wide = numVertexes > 65536;
+        size_t numIndexes = wide ? buffer.quads32.size() : buffer.quads16.size();
+        if (!buffer.vertexes.empty() || !buffer.normals.empty() || !buffer.faces.empty() ||
+            !(wide ? buffer.quads16.empty() : buffer.quads32.empty()) || numIndexes != numFaces * 4)
+            return false;
+        // unwelded corners take their normal from their face
+        if (!buffer.welded && numVertexes != numFaces * 4)
+            return false;
+        if (!(wide ? indexesBelow(buffer.quads32, numVertexes) : indexesBelow(buffer.quads16, numVertexes)))
+            return false;
+    }
+
+    if (!indexesBelow(buffer.faceNormals, 6) || !indexesBelow(buffer.occlusion, 4))
+        return false;
+    return (buffer.faceMaterials.empty() || buffer.faceMaterials.size() == numFaces) &&
+           (buffer.occlusion.empty() || buffer.occlusion.size() == numVertexes);
+}
+
+bool MeshCache::load(const MeshCacheKey& key, VoxelGroup& group)
+{
+    std::string file = path(key);
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    std::vector<uint8_t> content;
+    uint8_t block[1 << 16];
+    size_t read;
+    while ((read = fread(block, 1, sizeof(block), fp)) > 0)
+        content.insert(content.end(), block, block + read);
+    fclose(fp);
+
+    const uint8_t* cursor = content.data();
+    const uint8_t* end = cursor + content.size();
+    std::vector<uint32_t> header;
+    std::vector<uint64_t> storedKey;
+    bool valid = readArray(header, 1, cursor, end) && header[0] == CacheMagic && readArray(storedKey, 2, cursor, end) &&
+                 storedKey[0] == key.hash[0] && storedKey[1] == key.hash[1] && readArray(header, 1, cursor, end);
+
+    // a corrupted entry is a miss, it gets overwritten by the next store
+    group.clear();
+    for (uint32_t i = 0; valid && i < header[0]; i++) {
+        std::vector<uint32_t> sizes;
+        valid = readArray(sizes, 11, cursor, end);
+        if (!valid)
+            break;
+        VoxelBuffer& buffer = group[(MaterialID)sizes[0]];
+        buffer.compact = (sizes[1] & 1) != 0;
+        buffer.welded = (sizes[1] & 2) != 0;
+        valid = readArray(buffer.vertexes, sizes[2], cursor, end) && readArray(buffer.normals, sizes[3], cursor, end) &&
+                readArray(buffer.faces, sizes[4], cursor, end) &&
+                readArray(buffer.faceNormals, sizes[5], cursor, end) &&
+                readArray(buffer.corners, sizes[6], cursor, end) && readArray(buffer.quads16, sizes[7], cursor, end) &&
+                readArray(buffer.quads32, sizes[8], cursor, end) &&
+                readArray(buffer.faceMaterials, sizes[9], cursor, end) &&
+                readArray(buffer.occlusion, sizes[10], cursor, end) && validBuffer(buffer);
+    }
+
+    if (!valid || cursor != end) {
+        group.clear();
+        return false;
+    }
+
+    // the modification time is the last use for the eviction
+    utime(file.c_str(), nullptr);
+    return true;
+}
+
+template <typename T>
+static void writeArray(FILE* fp, const std::vector<T>& array)
+{
+    if (!array.empty())
+        fwrite(&array[0], sizeof(T), array.size(), fp);
+}
+
+bool MeshCache::store(const MeshCacheKey& key, const VoxelGroup& group)
+{
+    std::string file = path(key);
+    std::string temp = file + ".tmp." + std::to_string(getpid()) + "." + std::to_string(_tempCount++);
+    FILE* fp = fopen(temp.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    uint32_t numBuffers = group.size();
+    fwrite(&CacheMagic, 4, 1, fp);
+    fwrite(key.hash, 8, 2, fp);
+    fwrite(&numBuffers, 4, 1, fp);
+    for (VoxelGroup::const_iterator it = group.begin(); it != group.end(); it++) {
+        const VoxelBuffer& buffer = it->second;
+        uint32_t flags = (buffer.compact ? 1 : 0) | (buffer.welded ? 2 : 0);
+        uint32_t sizes[11] = {it->first,
+                              flags,
+                              (uint32_t)buffer.vertexes.size(),
+                              (uint32_t)buffer.normals.size(),
+                              (uint32_t)buffer.faces.size(),
+                              (uint32_t)buffer.faceNormals.size(),
+                              (uint32_t)buffer.corners.size(),
+                              (uint32_t)buffer.quads16.size(),
+                              (uint32_t)buffer.quads32.size(),
+                              (uint32_t)buffer.faceMaterials.size(),
+                              (uint32_t)buffer.occlusion.size()};
+        fwrite(sizes, 4, 11, fp);
+        writeArray(fp, buffer.vertexes);
+        writeArray(fp, buffer.normals);
+        writeArray(fp, buffer.faces);
+        writeArray(fp, buffer.faceNormals);
+        writeArray(fp, buffer.corners);
+        writeArray(fp, buffer.quads16);
+        writeArray(fp, buffer.quads32);
+        writeArray(fp, buffer.faceMaterials);
+        writeArray(fp, buffer.occlusion);
+    }
+
+    bool failed = ferror(fp) != 0;
+    failed = fclose(fp) != 0 || failed;
+    if (failed || rename(temp.c_str(), file.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+void MeshCache::trim()
+{
+    DIR* dir = opendir(_directory.c_str());
+    if (!dir)
+        return;
+
+    struct Entry {
+        time_t lastUse;
+        uint64_t size;
+        std::string path;
+        bool operator<(const Entry& other) const { return lastUse < other.lastUse; }
+    };
+
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+    time_t now = time(nullptr);
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        std::string file = _directory + "/" + name;
+        struct stat info;
+        if (stat(file.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            continue;
+
+        if (name.find(".tmp.") != std::string::npos) {
+            if (now - info.st_mtime > TempFileLifetime)
+                unlink(file.c_str());
+        } else if (name.size() > strlen(CacheExtension) &&
+                   name.compare(name.size() - strlen(CacheExtension), std::string::npos, CacheExtension) == 0) {
+            Entry cached = {info.st_mtime, (uint64_t)info.st_size, file};
+            entries.push_back(cached);
+            totalSize += info.st_size;
+        }
+    }
+    closedir(dir);
+
+    // another process may remove the same files, unlink failing is fine
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size() && totalSize > _maxBytes; i++) {
+        unlink(entries[i].path.c_str());
+        totalSize -= entries[i].size;
+    }
+}
+
+bool polygonizeModels(std::vector<VoxelGroup>& meshes, const VoxReader& reader, const std::vector<int>& models,
+                      const PolygonizeOptions& options)
+{
+    meshes.resize(reader.getNumModels());
+    std::vector<MeshCacheKey> keys(models.size());
+    std::vector<char> cached(models.size(), 0);
+    std::vector<char> invalid(models.size(), 0);
+    std::vector<VoxModel> voxels(models.size());
+    std::atomic<bool> failed(false);
+
+    // each step is done for every model before the next, so stages are timed apart
+    if (options.cache) {
+        StageTimer timer(options.stats, STAGE_READ);
+        parallelFor(options.threadPool, models.size(), [&](int i) {
+            keys[i] = MeshCache::modelKey(reader, models[i], options);
+            cached[i] = options.cache->load(keys[i], meshes[models[i]]);
+        });
+    }
+
+    {
+        // readModel does not touch the reader state, models can be decoded concurrently
+        StageTimer timer(options.stats, STAGE_PARSE);
+        parallelFor(options.threadPool, models.size(), [&](int i) {
+            if (!cached[i] && !reader.readModel(models[i], voxels[i])) {
+                logMessage(LOG_ERROR, "error decoding model %d\n", models[i]);
+                invalid[i] = 1;
+                failed = true;
+            }
+        });
+    }
+
+    {
+        StageTimer timer(options.stats, STAGE_MESH);
+        // a model that failed to decode is left empty, and out of the cache
+        parallelFor(options.threadPool, models.size(), [&](int i) {
+            if (cached[i] || invalid[i])
+                return;
+            polygonize(meshes[models[i]], voxels[i], options);
+            if (options.cache)
+                options.cache->store(keys[i], meshes[models[i]]);
+        });
+    }
+
+    if (options.stats) {
+        for (size_t i = 0; i < models.size(); i++) {
+            if (invalid[i])
+                continue;
+            uint64_t numVoxels = cached[i] ? reader.getModelInfo(models[i]).numVoxels : voxels[i].size();
+            options.stats->addMesh(models[i], numVoxels, meshes[models[i]], cached[i] != 0);
+        }
+    }
+    return !failed;
+}
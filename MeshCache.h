@@ -0,0 +1,51 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+class VoxReader;
+
+// 128 bits hash of everything a mesh depends on
+struct MeshCacheKey {
+    uint64_t hash[2];
+
+    std::string name() const;
+};
+
+// Fast non cryptographic hash, seed allows to chain calls
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed);
+
+// On disk cache of meshes, one file per key in a directory that can be shared
+// by concurrent processes. Files are written under a temporary name then
+// renamed, so a reader sees a complete file or none. A hit refreshes the file
+// modification time, trim removes the least recently used files until the
+// directory fits in maxBytes.
+class MeshCache {
+
+  public:
+    bool open(const std::string& directory, uint64_t maxBytes);
+
+    // key of a model: its XYZI bytes, the palette and materials of the file,
+    // the meshing options and the version of the mesher
+    static MeshCacheKey modelKey(const VoxReader& reader, int model, const PolygonizeOptions& options);
+
+    bool load(const MeshCacheKey& key, VoxelGroup& group);
+    bool store(const MeshCacheKey& key, const VoxelGroup& group);
+    void trim();
+
+  private:
+    std::string path(const MeshCacheKey& key) const;
+
+    std::string _directory;
+    uint64_t _maxBytes = 0;
+    std::atomic<int> _tempCount{0};
+};
+
+// Meshes the given models of reader, meshes being indexed by model. Meshes
+// come from options.cache when set and found there, models are decoded and
+// meshed in parallel when options has a thread pool.
+bool polygonizeModels(std::vector<VoxelGroup>& meshes, const VoxReader& reader, const std::vector<int>& models,
+                      const PolygonizeOptions& options);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Output.h"
+#include "Palette.h"
+#include "polygonize.h"
+
+#include <string>
+
+class ThreadPool;
+
+// Writes meshes one after the other into a single file, so a mesh can be
+// released as soon as it is written.
+class MeshWriter {
+
+  public:
+    virtual ~MeshWriter() {}
+
+    virtual bool open(const char* path) = 0;
+    // Writes into buffer, after its content, instead of a file. The palette
+    // material and texture of obj, written next to the file, are left out.
+    virtual bool open(OutputBuffer& buffer) = 0;
+    // an empty name writes the mesh without naming it
+    virtual bool write(const VoxelGroup& group, const std::string& name) = 0;
+    virtual bool close() = 0;
+
+    // Formats with instancing store a mesh once and place it with instances.
+    // addMesh returns the index of the mesh, -1 when it has no faces. matrix
+    // is a column major 4x4 transform.
+    virtual bool supportsInstancing() const { return false; }
+    virtual int addMesh(const VoxelGroup&, const std::string&) { return -1; }
+    virtual bool addInstance(int, const float*, const std::string&) { return false; }
+
+    // Formats with animation show what is written after beginFrame during
+    // [start, end) seconds of the looping animation only, up to the next
+    // beginFrame or close
+    virtual bool supportsAnimation() const { return false; }
+    virtual void beginFrame(const std::string&, float, float) {}
+
+    // Palette textured on atlas buffers, those with a material per face. Set
+    // before open, the writer then also writes the texture and the material.
+    virtual void setPalette(const Palette&) {}
+};
+
+// Writer for the format given by the extension of path, or by path being the
+// extension alone: binary glTF for .glb, obj otherwise. threadPool formats obj text in parallel when set. With
+// triangles, quads are split and the triangles and vertexes of each material
+// ordered for the vertex cache of GPUs, glTF output is always triangles.
+MeshWriter* createMeshWriter(const char* path, ThreadPool* threadPool = nullptr, bool triangles = false);
+MeshWriter* createOBJWriter(ThreadPool* threadPool = nullptr, bool triangles = false);
+MeshWriter* createGLBWriter(bool optimize = false);
@@ -0,0 +1,64 @@
+#include "Output.h"
+
+#include <cstdlib>
+#include <cstring>
+
+bool OutputBuffer::reserve(size_t count)
+{
+    if (capacity - size >= count)
+        return true;
+    size_t wanted = capacity * 2 > size + count ? capacity * 2 : size + count;
+    void* block = reallocate ? reallocate(data, wanted, user) : realloc(data, wanted);
+    if (!block)
+        return false;
+    data = (uint8_t*)block;
+    capacity = wanted;
+    return true;
+}
+
+bool OutputBuffer::append(const void* bytes, size_t count)
+{
+    if (!count)
+        return true;
+    if (!reserve(count))
+        return false;
+    memcpy(data + size, bytes, count);
+    size += count;
+    return true;
+}
+
+bool Output::open(const char* path, bool binary)
+{
+    close();
+    _fp = fopen(path, binary ? "wb" : "w");
+    _failed = false;
+    return _fp != nullptr;
+}
+
+void Output::open(OutputBuffer& buffer)
+{
+    close();
+    _buffer = &buffer;
+    _failed = false;
+}
+
+void Output::write(const void* data, size_t size)
+{
+    if (_failed || !size)
+        return;
+    if (_fp) {
+        _failed = fwrite(data, size, 1, _fp) != 1;
+    } else if (_buffer) {
+        _failed = !_buffer->append(data, size);
+    }
+}
+
+bool Output::close()
+{
+    bool written = !failed();
+    if (_fp)
+        written = fclose(_fp) == 0 && written;
+    _fp = nullptr;
+    _buffer = nullptr;
+    return written;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdio.h>
+
+// Memory owned by the caller that a writer fills instead of a file. Bytes are
+// appended after size. The block grows through reallocate, which gets the
+// block, null at first, and the capacity wanted, and returns the new block or
+// null when out of memory. Without reallocate realloc is used, data is then
+// released with free.
+struct OutputBuffer {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+    void* (*reallocate)(void* block, size_t capacity, void* user) = nullptr;
+    void* user = nullptr;
+
+    // makes room for count more bytes, the capacity at least doubling
+    bool reserve(size_t count);
+    bool append(const void* bytes, size_t count);
+};
+
+// Destination of a writer, a file or an OutputBuffer. Once a write failed the
+// next ones are dropped and close reports it.
+class Output {
+
+  public:
+    ~Output() { close(); }
+
+    // binary opens the file without newline translation
+    bool open(const char* path, bool binary);
+    void open(OutputBuffer& buffer);
+    bool isOpen() const { return _fp || _buffer; }
+    // the buffer given to open, null for a file
+    OutputBuffer* buffer() const { return _buffer; }
+
+    void write(const void* data, size_t size);
+    bool failed() const { return _failed || (_fp && ferror(_fp)); }
+    // returns false when a write failed
+    bool close();
+
+  private:
+    FILE* _fp = nullptr;
+    OutputBuffer* _buffer = nullptr;
+    bool _failed = false;
+};
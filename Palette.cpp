@@ -0,0 +1,154 @@
+#include "Palette.h"
+#include "Log.h"
+#include "VoxReader.h"
+
+#include <cstring>
+#include <stdio.h>
+
+void defaultPalette(Palette& palette)
+{
+    memset(palette.colors, 0, sizeof(palette.colors));
+
+    // entries 1 to 215 are the 6x6x6 color cube from white, black excluded,
+    // blue changing first
+    static const uint8_t Steps[6] = {0xff, 0xcc, 0x99, 0x66, 0x33, 0x00};
+    int index = 1;
+    for (int r = 0; r < 6; r++) {
+        for (int g = 0; g < 6; g++) {
+            for (int b = 0; b < 6 && index < 216; b++, index++) {
+                uint8_t* color = palette.colors[index];
+                color[0] = Steps[r];
+                color[1] = Steps[g];
+                color[2] = Steps[b];
+                color[3] = 0xff;
+            }
+        }
+    }
+
+    // then ramps of red, green, blue and gray skipping the cube values
+    static const uint8_t Ramp[10] = {0xee, 0xdd, 0xbb, 0xaa, 0x88, 0x77, 0x55, 0x44, 0x22, 0x11};
+    for (int channel = 0; channel < 4; channel++) {
+        for (int i = 0; i < 10; i++, index++) {
+            uint8_t* color = palette.colors[index];
+            for (int c = 0; c < 3; c++)
+                color[c] = channel == c || channel == 3 ? Ramp[i] : 0;
+            color[3] = 0xff;
+        }
+    }
+}
+
+void readPalette(Palette& palette, VoxReader& reader)
+{
+    const VoxPalette* colors = reader.getPalette();
+    if (!colors) {
+        defaultPalette(palette);
+        return;
+    }
+
+    // colors are stored as read from the file, RGBA bytes in a little endian int
+    memset(palette.colors, 0, sizeof(palette.colors));
+    for (int i = 1; i < 256; i++) {
+        uint32_t color = (*colors)[i];
+        for (int c = 0; c < 4; c++)
+            palette.colors[i][c] = (color >> (c * 8)) & 0xff;
+    }
+}
+
+struct CrcTable {
+    uint32_t values[256];
+
+    CrcTable()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int k = 0; k < 8; k++)
+                value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            values[i] = value;
+        }
+    }
+};
+
+static uint32_t crc32(const uint8_t* data, size_t size)
+{
+    // initialized once even with conversions running on several threads
+    static const CrcTable table;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; i++)
+        crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back((value >> shift) & 0xff);
+}
+
+static void appendChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data)
+{
+    appendBigEndian(png, data.size());
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    appendBigEndian(png, crc32(&png[start], png.size() - start));
+}
+
+void encodePNG(std::vector<uint8_t>& png, const uint8_t* rgba, int width, int height)
+{
+    static const uint8_t Signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    png.assign(Signature, Signature + 8);
+
+    std::vector<uint8_t> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    // 8 bits per channel, RGBA, deflate, adaptive filters, no interlace
+    const uint8_t format[5] = {8, 6, 0, 0, 0};
+    header.insert(header.end(), format, format + 5);
+    appendChunk(png, "IHDR", header);
+
+    // every scanline starts with its filter type, none here
+    std::vector<uint8_t> raw;
+    size_t rowSize = (size_t)width * 4;
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgba + y * rowSize, rgba + (y + 1) * rowSize);
+    }
+
+    // zlib stream of stored blocks of at most 65535 bytes
+    std::vector<uint8_t> data = {0x78, 0x01};
+    size_t offset = 0;
+    do {
+        size_t size = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+        bool last = offset + size == raw.size();
+        data.push_back(last ? 1 : 0);
+        data.push_back(size & 0xff);
+        data.push_back(size >> 8);
+        data.push_back(~size & 0xff);
+        data.push_back((~size >> 8) & 0xff);
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    } while (offset < raw.size());
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendBigEndian(data, (b << 16) | a);
+    appendChunk(png, "IDAT", data);
+    appendChunk(png, "IEND", std::vector<uint8_t>());
+}
+
+bool writePNG(const char* path, const uint8_t* rgba, int width, int height)
+{
+    std::vector<uint8_t> png;
+    encodePNG(png, rgba, width, height);
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        logMessage(LOG_ERROR, "Failed to open %s\n", path);
+        return false;
+    }
+    bool written = fwrite(png.data(), png.size(), 1, fp) == 1;
+    return fclose(fp) == 0 && written;
+}
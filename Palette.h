@@ -0,0 +1,28 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <cstdint>
+#include <vector>
+
+class VoxReader;
+
+// Colors of the 256 entries of a vox palette as RGBA bytes, indexed by
+// MaterialID. Entry 0 is the empty voxel and stays transparent.
+struct Palette {
+    uint8_t colors[256][4];
+};
+
+// Palette of the file, the default MagicaVoxel one when it has no RGBA chunk
+void readPalette(Palette& palette, VoxReader& reader);
+void defaultPalette(Palette& palette);
+
+// Texture coordinates of the center of the texel of a material in the 256x1
+// palette texture
+inline float paletteU(MaterialID material) { return (material + 0.5f) / 256.0f; }
+static const float PaletteV = 0.5f;
+
+// PNG file of width x height RGBA pixels. Deflate blocks are stored, the
+// image is uncompressed.
+void encodePNG(std::vector<uint8_t>& png, const uint8_t* rgba, int width, int height);
+bool writePNG(const char* path, const uint8_t* rgba, int width, int height);
@@ -0,0 +1,93 @@
+#include "Pipeline.h"
+#include "BoundedQueue.h"
+#include "Log.h"
+#include "MeshCache.h"
+#include "MeshWriter.h"
+#include "Stats.h"
+#include "VoxReader.h"
+
+#include <thread>
+
+// a model found in the cache skips meshing, group is already filled, one that
+// failed to decode is neither meshed, stored in the cache nor written
+struct DecodedModel {
+    int index;
+    VoxModel voxels;
+    bool cached = false;
+    bool failed = false;
+    MeshCacheKey key;
+    VoxelGroup group;
+};
+
+struct MeshedModel {
+    int index;
+    VoxelGroup group;
+};
+
+bool convertPipelined(VoxReader& reader, MeshWriter& writer, const PolygonizeOptions& options, size_t queueSize)
+{
+    BoundedQueue<DecodedModel> decoded(queueSize);
+    BoundedQueue<MeshedModel> meshed(queueSize);
+    bool readFailed = false;
+
+    std::thread readStage([&] {
+        for (int i = 0; i < reader.getNumModels(); i++) {
+            DecodedModel model;
+            model.index = i;
+            if (options.cache) {
+                StageTimer timer(options.stats, STAGE_READ);
+                model.key = MeshCache::modelKey(reader, i, options);
+                model.cached = options.cache->load(model.key, model.group);
+            }
+            if (!model.cached) {
+                StageTimer timer(options.stats, STAGE_PARSE);
+                if (!reader.readModel(i, model.voxels)) {
+                    logMessage(LOG_ERROR, "error decoding model %d\n", i);
+                    model.failed = true;
+                    readFailed = true;
+                }
+            }
+            decoded.push(std::move(model));
+        }
+        decoded.close();
+    });
+
+    std::thread meshStage([&] {
+        DecodedModel model;
+        while (decoded.pop(model)) {
+            if (model.failed)
+                continue;
+            MeshedModel mesh;
+            mesh.index = model.index;
+            uint64_t numVoxels = reader.getModelInfo(model.index).numVoxels;
+            if (model.cached) {
+                mesh.group.swap(model.group);
+            } else {
+                StageTimer timer(options.stats, STAGE_MESH);
+                polygonize(mesh.group, model.voxels, options);
+                VoxModel().swap(model.voxels);
+                if (options.cache)
+                    options.cache->store(model.key, mesh.group);
+            }
+            if (options.stats)
+                options.stats->addMesh(mesh.index, numVoxels, mesh.group, model.cached);
+            meshed.push(std::move(mesh));
+        }
+        meshed.close();
+    });
+
+    // after a write error the queue is still drained so the other stages end
+    bool written = true;
+    MeshedModel mesh;
+    while (meshed.pop(mesh)) {
+        StageTimer timer(options.stats, STAGE_WRITE);
+        if (written)
+            written = writer.write(mesh.group, "model_" + std::to_string(mesh.index));
+        VoxelGroup().swap(mesh.group);
+    }
+
+    readStage.join();
+    meshStage.join();
+
+    return written && !readFailed;
+}
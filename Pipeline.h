@@ -0,0 +1,13 @@
+#pragma once
+
+#include "polygonize.h"
+
+class MeshWriter;
+class VoxReader;
+
+// Converts every model of reader into writer, named model_N. Decoding,
+// meshing and writing run on their own threads, model N+1 being decoded while
+// model N is meshed and model N-1 written. Bounded queues between the stages
+// hold at most queueSize models each, and a mesh is freed once written. A
+// model that fails to decode is reported and left out, false is then returned.
+bool convertPipelined(VoxReader& reader, MeshWriter& writer, const PolygonizeOptions& options, size_t queueSize = 2);
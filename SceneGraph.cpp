@@ -0,0 +1,300 @@
+#include "SceneGraph.h"
+#include "Log.h"
+#include "MeshCache.h"
+#include "MeshWriter.h"
+#include "VoxReader.h"
+
+#include <algorithm>
+#include <math.h>
+#include <unordered_set>
+
+static const int Identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+
+// Transform of a node, applied to the positions of its children
+struct NodeTransform {
+    int rotation[9];
+    int translation[3];
+};
+
+static void composeTransform(NodeTransform& result, const NodeTransform& parent, const VoxTransform::Frame& frame)
+{
+    int rotation[9];
+    for (int i = 0; i < 9; i++)
+        rotation[i] = (int)lrintf(frame.rotation[i]);
+
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 3; column++) {
+            int value = 0;
+            for (int k = 0; k < 3; k++)
+                value += parent.rotation[row * 3 + k] * rotation[k * 3 + column];
+            result.rotation[row * 3 + column] = value;
+        }
+
+        int value = parent.translation[row];
+        for (int k = 0; k < 3; k++)
+            value += parent.rotation[row * 3 + k] * frame.translation[k];
+        result.translation[row] = value;
+    }
+}
+
+static bool visitNode(std::vector<VoxInstance>& instances, VoxReader& reader, int nodeId,
+                      const NodeTransform& transform, const VoxString& name, int frame,
+                      std::unordered_set<int>& visited)
+{
+    // a well formed graph is a tree, a node reached twice is in a cycle or
+    // shared by two parents, which multiplies the instances at each level
+    if (!visited.insert(nodeId).second) {
+        logMessage(LOG_ERROR, "node %d is referenced more than once\n", nodeId);
+        return false;
+    }
+
+    if (const VoxTransform* node = reader.getTransform(nodeId)) {
+        if (node->hidden)
+            return true;
+        NodeTransform child;
+        composeTransform(child, transform, node->frameAt(frame));
+        return visitNode(instances, reader, node->childNodeId, child, node->name.empty() ? name : node->name, frame,
+                         visited);
+    } else if (const VoxGroup* node = reader.getGroup(nodeId)) {
+        if (node->hidden)
+            return true;
+        for (int i = 0; i < node->numChildren; i++) {
+            if (!visitNode(instances, reader, node->children[i], transform, name, frame, visited))
+                return false;
+        }
+    } else if (const VoxShape* node = reader.getShape(nodeId)) {
+        const VoxShape::Model* shapeModel = node->modelAt(frame);
+        if (node->hidden || !shapeModel)
+            return true;
+
+        int model = shapeModel->modelId;
+        if (model < 0 || model >= reader.getNumModels()) {
+            logMessage(LOG_ERROR, "shape %d references missing model %d\n", nodeId, model);
+            return true;
+        }
+
+        // voxels are placed relative to the center of the model
+        const VoxModelInfo& info = reader.getModelInfo(model);
+        int pivot[3] = {(int)info.sizeX / 2, (int)info.sizeY / 2, (int)info.sizeZ / 2};
+
+        VoxInstance instance;
+        instance.model = model;
+        instance.name = name.str();
+        for (int row = 0; row < 3; row++) {
+            instance.translation[row] = transform.translation[row];
+            for (int k = 0; k < 3; k++) {
+                instance.rotation[row * 3 + k] = transform.rotation[row * 3 + k];
+                instance.translation[row] -= transform.rotation[row * 3 + k] * pivot[k];
+            }
+        }
+        instances.push_back(instance);
+    }
+    return true;
+}
+
+bool flattenScene(std::vector<VoxInstance>& instances, VoxReader& reader)
+{
+    if (reader.getNumNodes() == 0) {
+        for (int i = 0; i < reader.getNumModels(); i++) {
+            VoxInstance instance;
+            instance.model = i;
+            std::copy(Identity, Identity + 9, instance.rotation);
+            instance.translation[0] = instance.translation[1] = instance.translation[2] = 0;
+            instances.push_back(instance);
+        }
+        return true;
+    }
+
+    return flattenFrame(instances, reader, 0);
+}
+
+bool flattenFrame(std::vector<VoxInstance>& instances, VoxReader& reader, int frame)
+{
+    if (reader.getNumNodes() == 0) {
+        if (frame >= 0 && frame < reader.getNumModels()) {
+            VoxInstance instance;
+            instance.model = frame;
+            std::copy(Identity, Identity + 9, instance.rotation);
+            instance.translation[0] = instance.translation[1] = instance.translation[2] = 0;
+            instances.push_back(instance);
+        }
+        return true;
+    }
+
+    NodeTransform root;
+    std::copy(Identity, Identity + 9, root.rotation);
+    root.translation[0] = root.translation[1] = root.translation[2] = 0;
+    std::unordered_set<int> visited;
+    bool flattened = visitNode(instances, reader, 0, root, VoxString(), frame, visited);
+    return flattened && !reader.failed();
+}
+
+bool polygonizeInstances(std::vector<VoxelGroup>& meshes, const VoxReader& reader,
+                         const std::vector<VoxInstance>& instances, const PolygonizeOptions& options)
+{
+    meshes.clear();
+    std::vector<bool> used(reader.getNumModels(), false);
+    std::vector<int> models;
+    for (const VoxInstance& instance : instances) {
+        if (!used[instance.model])
+            models.push_back(instance.model);
+        used[instance.model] = true;
+    }
+    return polygonizeModels(meshes, reader, models, options);
+}
+
+static inline fvec3 transformVector(const int* rotation, const fvec3& v)
+{
+    fvec3 result;
+    for (int row = 0; row < 3; row++)
+        result[row] = rotation[row * 3] * v[0] + rotation[row * 3 + 1] * v[1] + rotation[row * 3 + 2] * v[2];
+    return result;
+}
+
+static bool isIdentity(const VoxInstance& instance)
+{
+    return std::equal(Identity, Identity + 9, instance.rotation) && instance.translation[0] == 0 &&
+           instance.translation[1] == 0 && instance.translation[2] == 0;
+}
+
+void bakeInstance(VoxelGroup& world, const VoxelGroup& mesh, const VoxInstance& instance)
+{
+    const int* rotation = instance.rotation;
+    int determinant = rotation[0] * (rotation[4] * rotation[8] - rotation[5] * rotation[7]) -
+                      rotation[1] * (rotation[3] * rotation[8] - rotation[5] * rotation[6]) +
+                      rotation[2] * (rotation[3] * rotation[7] - rotation[4] * rotation[6]);
+
+    // direction index of each rotated axis normal
+    uint8_t directions[6];
+    for (int f = 0; f < 6; f++) {
+        fvec3 normal = transformVector(rotation, NormalFace[f]);
+        for (int g = 0; g < 6; g++) {
+            if (normal[0] == NormalFace[g][0] && normal[1] == NormalFace[g][1] && normal[2] == NormalFace[g][2])
+                directions[f] = g;
+        }
+    }
+
+    // a lattice corner is position + 0.5, rotating the 0.5 offset of each
+    // axis gives -0.5 or 0.5 so the corner moves by 0 or 1 more
+    int latticeShift[3];
+    for (int row = 0; row < 3; row++)
+        latticeShift[row] = (1 - rotation[row * 3] - rotation[row * 3 + 1] - rotation[row * 3 + 2]) / 2;
+
+    fvec3 translation((float)instance.translation[0], (float)instance.translation[1], (float)instance.translation[2]);
+    auto moveCorner = [&](const svec3& corner) {
+        ivec3 moved;
+        for (int row = 0; row < 3; row++)
+            moved[row] = rotation[row * 3] * corner[0] + rotation[row * 3 + 1] * corner[1] +
+                         rotation[row * 3 + 2] * corner[2] + instance.translation[row] + latticeShift[row];
+        return moved;
+    };
+
+    for (VoxelGroup::const_iterator it = mesh.begin(); it != mesh.end(); it++) {
+        const VoxelBuffer* source = &it->second;
+        VoxelBuffer& buffer = world[it->first];
+        int base = buffer.numVertexes();
+        buffer.faceMaterials.insert(buffer.faceMaterials.end(), source->faceMaterials.begin(),
+                                    source->faceMaterials.end());
+        buffer.occlusion.insert(buffer.occlusion.end(), source->occlusion.begin(), source->occlusion.end());
+
+        // corners moved out of the 16 bits range, or into a buffer already
+        // in float storage, are baked from a float copy of the model
+        VoxelBuffer expanded;
+        if (source->compact) {
+            bool fits = buffer.compact || buffer.numVertexes() == 0;
+            for (size_t i = 0; fits && i < source->corners.size(); i++) {
+                ivec3 moved = moveCorner(source->corners[i]);
+                for (int row = 0; row < 3; row++)
+                    fits = fits && moved[row] >= INT16_MIN && moved[row] <= INT16_MAX;
+            }
+            if (!fits) {
+                expanded = *source;
+                expanded.expand();
+                source = &expanded;
+                buffer.expand();
+            }
+        }
+
+        if (source->compact) {
+            buffer.compact = true;
+            buffer.welded = source->welded;
+            for (const svec3& corner : source->corners) {
+                ivec3 moved = moveCorner(corner);
+                buffer.addCorner(svec3((int16_t)moved[0], (int16_t)moved[1], (int16_t)moved[2]));
+            }
+            for (size_t i = 0; i < source->numFaces(); i++) {
+                Face face = source->face(i);
+                Face moved = face;
+                if (determinant < 0) {
+                    moved.v[1] = face.v[3];
+                    moved.v[3] = face.v[1];
+                }
+                moved += base;
+                buffer.addQuad(moved, directions[source->faceNormals[i]]);
+            }
+            continue;
+        }
+
+        for (const fvec3& v : source->vertexes) {
+            fvec3 position = transformVector(rotation, v);
+            position += translation;
+            buffer.vertexes.push_back(position);
+        }
+        for (const fvec3& n : source->normals)
+            buffer.normals.push_back(transformVector(rotation, n));
+
+        // a mirroring rotation turns faces inside out, their winding is reversed
+        for (const Face& face : source->faces) {
+            Face moved = face;
+            if (determinant < 0) {
+                moved.v[1] = face.v[3];
+                moved.v[3] = face.v[1];
+            }
+            moved += base;
+            buffer.faces.push_back(moved);
+        }
+        for (uint8_t f : source->faceNormals)
+            buffer.faceNormals.push_back(directions[f]);
+    }
+}
+
+void instanceMatrix(float* matrix, const VoxInstance& instance)
+{
+    std::fill(matrix, matrix + 16, 0.0f);
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 3; column++)
+            matrix[column * 4 + row] = instance.rotation[row * 3 + column];
+        matrix[12 + row] = instance.translation[row];
+    }
+    matrix[15] = 1;
+}
+
+bool writeScene(MeshWriter& writer, const std::vector<VoxelGroup>& meshes, const std::vector<VoxInstance>& instances,
+                bool bake)
+{
+    // a lone model at the origin is written as is
+    if (instances.size() == 1 && isIdentity(instances[0]))
+        return writer.write(meshes[instances[0].model], std::string());
+
+    if (!bake && writer.supportsInstancing()) {
+        std::vector<int> meshIndexes(meshes.size(), -2);
+        for (const VoxInstance& instance : instances) {
+            int& mesh = meshIndexes[instance.model];
+            if (mesh == -2)
+                mesh = writer.addMesh(meshes[instance.model], "model_" + std::to_string(instance.model));
+            if (mesh < 0)
+                continue;
+
+            float matrix[16];
+            instanceMatrix(matrix, instance);
+            if (!writer.addInstance(mesh, matrix, instance.name))
+                return false;
+        }
+        return true;
+    }
+
+    VoxelGroup world;
+    for (const VoxInstance& instance : instances)
+        bakeInstance(world, meshes[instance.model], instance);
+    return writer.write(world, std::string());
+}
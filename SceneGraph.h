@@ -0,0 +1,49 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <string>
+#include <vector>
+
+class MeshWriter;
+class VoxReader;
+
+// A model placed in the scene: world = rotation * position + translation for a
+// position in the model voxel coordinates. The pivot of the model, the center
+// of its size, is already folded into translation.
+struct VoxInstance {
+    int model;
+    int rotation[9]; // row major, entries are -1, 0 or 1
+    int translation[3];
+    std::string name; // of the closest named transform, may be empty
+};
+
+// Walks the transform, group and shape nodes from the root node and composes
+// the transforms at animation frame 0 down the hierarchy. Hidden nodes are
+// skipped. Files without nodes give one instance per model at the origin.
+// Returns false when the file has a malformed chunk or a node referenced
+// more than once, the nodes are then not a tree.
+bool flattenScene(std::vector<VoxInstance>& instances, VoxReader& reader);
+
+// Instances at an animation frame, with the transform frame and the shape
+// model of each node at that frame. Files without nodes store a model per
+// frame, the frame is then model frame at the origin.
+bool flattenFrame(std::vector<VoxInstance>& instances, VoxReader& reader, int frame);
+
+// Meshes each model referenced by instances once, meshes is indexed by model
+// and left empty for the others. Models are decoded and meshed in parallel
+// when options has a thread pool. Returns false when a model failed to decode.
+bool polygonizeInstances(std::vector<VoxelGroup>& meshes, const VoxReader& reader,
+                         const std::vector<VoxInstance>& instances, const PolygonizeOptions& options);
+
+// Appends the mesh of a model to world, moved to where instance places it
+void bakeInstance(VoxelGroup& world, const VoxelGroup& mesh, const VoxInstance& instance);
+
+// Column major 4x4 matrix placing an instance, as glTF expects
+void instanceMatrix(float* matrix, const VoxInstance& instance);
+
+// Writes the meshes once and a node per instance when the writer supports
+// instancing and bake is false, a single mesh with every instance baked in
+// world space otherwise
+bool writeScene(MeshWriter& writer, const std::vector<VoxelGroup>& meshes, const std::vector<VoxInstance>& instances,
+                bool bake);
@@ -0,0 +1,179 @@
+#include "Stats.h"
+#include "Json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+static const char* StageNames[NUM_STAGES] = {"read", "parse", "mesh", "write"};
+
+static double wallTime()
+{
+    std::chrono::duration<double> now = std::chrono::steady_clock::now().time_since_epoch();
+    return now.count();
+}
+
+// processor time of every thread of the process
+static double cpuTime() { return (double)std::clock() / CLOCKS_PER_SEC; }
+
+uint64_t peakMemoryUsage()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+StageTimer::StageTimer(Stats* stats, Stage stage)
+    : _stats(stats)
+    , _stage(stage)
+{
+    if (_stats) {
+        _wallStart = wallTime();
+        _cpuStart = cpuTime();
+    }
+}
+
+StageTimer::~StageTimer()
+{
+    if (_stats)
+        _stats->addStage(_stage, wallTime() - _wallStart, cpuTime() - _cpuStart);
+}
+
+void Stats::addStage(Stage stage, double wallSeconds, double cpuSeconds)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stages[stage].wallSeconds += wallSeconds;
+    _stages[stage].cpuSeconds += cpuSeconds;
+    _stages[stage].count++;
+}
+
+void Stats::addModel(const ModelStats& model)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _models.push_back(model);
+}
+
+void Stats::addMesh(int model, uint64_t voxels, const VoxelGroup& group, bool cached, int lod)
+{
+    ModelStats stats;
+    stats.model = model;
+    stats.voxels = voxels;
+    stats.cached = cached;
+    stats.lod = lod;
+    for (VoxelGroup::const_iterator it = group.begin(); it != group.end(); it++) {
+        stats.faces += it->second.numFaces();
+        stats.vertexes += it->second.numVertexes();
+    }
+    addModel(stats);
+}
+
+void Stats::addBytesWritten(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _bytesWritten += bytes;
+}
+
+void Stats::addFile(bool converted)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _files++;
+    if (!converted)
+        _failedFiles++;
+}
+
+void Stats::merge(const Stats& other, const std::string& file)
+{
+    std::lock_guard<std::mutex> otherLock(other._mutex);
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int i = 0; i < NUM_STAGES; i++) {
+        _stages[i].wallSeconds += other._stages[i].wallSeconds;
+        _stages[i].cpuSeconds += other._stages[i].cpuSeconds;
+        _stages[i].count += other._stages[i].count;
+    }
+    for (const ModelStats& model : other._models) {
+        _models.push_back(model);
+        _models.back().file = file;
+    }
+    _bytesWritten += other._bytesWritten;
+    _files += other._files;
+    _failedFiles += other._failedFiles;
+}
+
+void Stats::print(FILE* fp) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    fprintf(fp, "stage      wall ms     cpu ms\n");
+    for (int i = 0; i < NUM_STAGES; i++)
+        fprintf(fp, "%-6s %11.3f %10.3f\n", StageNames[i], _stages[i].wallSeconds * 1000,
+                _stages[i].cpuSeconds * 1000);
+
+    fprintf(fp, "\n%-24s %5s %10s %10s %10s\n", "file", "model", "voxels", "faces", "vertexes");
+    int numLods = 0;
+    for (const ModelStats& model : _models) {
+        fprintf(fp, "%-24s %5d %10llu %10llu %10llu%s", model.file.c_str(), model.model,
+                (unsigned long long)model.voxels, (unsigned long long)model.faces,
+                (unsigned long long)model.vertexes, model.cached ? " cached" : "");
+        if (model.lod)
+            fprintf(fp, " lod %d", model.lod);
+        fprintf(fp, "\n");
+        numLods = std::max(numLods, model.lod + 1);
+    }
+
+    // face budget of each level of detail against the models themselves
+    if (numLods > 1) {
+        std::vector<uint64_t> faces(numLods, 0);
+        std::vector<uint64_t> vertexes(numLods, 0);
+        for (const ModelStats& model : _models) {
+            faces[model.lod] += model.faces;
+            vertexes[model.lod] += model.vertexes;
+        }
+        fprintf(fp, "\n%-5s %10s %10s %8s\n", "lod", "faces", "vertexes", "faces %");
+        for (int lod = 0; lod < numLods; lod++) {
+            fprintf(fp, "%-5d %10llu %10llu %8.1f\n", lod, (unsigned long long)faces[lod],
+                    (unsigned long long)vertexes[lod], faces[0] ? 100.0 * faces[lod] / faces[0] : 0.0);
+        }
+    }
+
+    fprintf(fp, "\nfiles: %d, failed: %d\n", _files, _failedFiles);
+    fprintf(fp, "bytes written: %llu\n", (unsigned long long)_bytesWritten);
+    fprintf(fp, "peak memory: %.1f MB\n", peakMemoryUsage() / (1024.0 * 1024.0));
+}
+
+void Stats::printJSON(FILE* fp) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    fprintf(fp, "{\n  \"stages\": {\n");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        fprintf(fp, "    \"%s\": {\"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"count\": %d}%s\n", StageNames[i],
+                _stages[i].wallSeconds, _stages[i].cpuSeconds, _stages[i].count, i + 1 < NUM_STAGES ? "," : "");
+    }
+    fprintf(fp, "  },\n  \"models\": [\n");
+    for (size_t i = 0; i < _models.size(); i++) {
+        const ModelStats& model = _models[i];
+        fprintf(fp,
+                "    {\"file\": \"%s\", \"model\": %d, \"lod\": %d, \"voxels\": %llu, \"faces\": %llu, "
+                "\"vertexes\": %llu, \"cached\": %s}%s\n",
+                escapeJSON(model.file).c_str(), model.model, model.lod, (unsigned long long)model.voxels,
+                (unsigned long long)model.faces, (unsigned long long)model.vertexes, model.cached ? "true" : "false",
+                i + 1 < _models.size() ? "," : "");
+    }
+    fprintf(fp, "  ],\n  \"files\": %d,\n  \"failed_files\": %d,\n", _files, _failedFiles);
+    fprintf(fp, "  \"bytes_written\": %llu,\n  \"peak_rss_bytes\": %llu\n}\n", (unsigned long long)_bytesWritten,
+            (unsigned long long)peakMemoryUsage());
+}
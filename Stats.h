@@ -0,0 +1,74 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <cstdint>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Read is the file mapping, chunk index and cache lookups, parse the decoding
+// of models and nodes
+enum Stage { STAGE_READ, STAGE_PARSE, STAGE_MESH, STAGE_WRITE, NUM_STAGES };
+
+struct StageStats {
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+    int count = 0;
+};
+
+struct ModelStats {
+    std::string file;
+    int model = 0;
+    uint64_t voxels = 0;
+    uint64_t faces = 0;
+    uint64_t vertexes = 0;
+    bool cached = false;
+    // level of detail of the mesh, 0 for the model itself
+    int lod = 0;
+};
+
+// Counters of a run, filled from any thread. CPU time is the time of the whole
+// process during a stage, so it includes the threads of the pool. Stages
+// running at the same time, with --pipeline or in batch mode, overlap.
+class Stats {
+
+  public:
+    void addStage(Stage stage, double wallSeconds, double cpuSeconds);
+    void addModel(const ModelStats& model);
+    void addMesh(int model, uint64_t voxels, const VoxelGroup& group, bool cached, int lod = 0);
+    void addBytesWritten(uint64_t bytes);
+    void addFile(bool converted);
+    // adds the counters of other, its models being attributed to file
+    void merge(const Stats& other, const std::string& file);
+
+    void print(FILE* fp) const;
+    void printJSON(FILE* fp) const;
+
+  private:
+    mutable std::mutex _mutex;
+    StageStats _stages[NUM_STAGES];
+    std::vector<ModelStats> _models;
+    uint64_t _bytesWritten = 0;
+    int _files = 0;
+    int _failedFiles = 0;
+};
+
+// Adds the time from its construction to its destruction to a stage of stats,
+// does nothing when stats is null
+class StageTimer {
+
+  public:
+    StageTimer(Stats* stats, Stage stage);
+    ~StageTimer();
+
+  private:
+    Stats* _stats;
+    Stage _stage;
+    double _wallStart = 0;
+    double _cpuStart = 0;
+};
+
+// peak resident set size of the process in bytes
+uint64_t peakMemoryUsage();
@@ -0,0 +1,137 @@
+#include "ThreadPool.h"
+
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local int currentPoolQueue = 0;
+
+ThreadPool::ThreadPool(int numThreads)
+    : _queuedTasks(0)
+    , _stop(false)
+{
+    int numWorkers = numThreads > 1 ? numThreads - 1 : 0;
+
+    // queue 0 is shared by the threads outside of the pool
+    for (int i = 0; i <= numWorkers; i++)
+        _queues.push_back(std::unique_ptr<Queue>(new Queue));
+
+    for (int i = 1; i <= numWorkers; i++)
+        _threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _stop = true;
+    }
+    _sleepCondition.notify_all();
+
+    for (std::thread& thread : _threads)
+        thread.join();
+}
+
+int ThreadPool::currentQueue() const { return currentPool == this ? currentPoolQueue : 0; }
+
+bool ThreadPool::popTask(int queueIndex, Task& task)
+{
+    // own tasks are taken from the back, stolen ones from the front
+    for (size_t i = 0; i < _queues.size(); i++) {
+        Queue& queue = *_queues[(queueIndex + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+
+        if (i == 0) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        } else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        _queuedTasks--;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::runOneTask(int queueIndex)
+{
+    Task task;
+    if (!popTask(queueIndex, task))
+        return false;
+
+    // the exception is kept for the caller of parallelFor, pending has to
+    // reach 0 whatever happens as the call lives on the caller's stack
+    Call& call = *task.call;
+    if (!call.failed) {
+        try {
+            (*call.func)(task.index);
+        } catch (...) {
+            if (!call.failed.exchange(true))
+                call.error = std::current_exception();
+        }
+    }
+    call.pending--;
+    return true;
+}
+
+void ThreadPool::workerLoop(int queueIndex)
+{
+    currentPool = this;
+    currentPoolQueue = queueIndex;
+
+    for (;;) {
+        if (runOneTask(queueIndex))
+            continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleepCondition.wait(lock, [this] { return _stop || _queuedTasks > 0; });
+        if (_stop && _queuedTasks == 0)
+            return;
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& func)
+{
+    if (_threads.empty() || count == 1) {
+        for (int i = 0; i < count; i++)
+            func(i);
+        return;
+    }
+
+    int queueIndex = currentQueue();
+    Call call;
+    call.func = &func;
+    call.pending = count;
+    call.failed = false;
+    {
+        // pushed in reverse so the owner pops them in order
+        Queue& queue = *_queues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (int i = count - 1; i >= 0; i--) {
+            Task task = {&call, i};
+            queue.tasks.push_back(task);
+        }
+        _queuedTasks += count;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _sleepCondition.notify_all();
+
+    while (call.pending > 0) {
+        if (!runOneTask(queueIndex))
+            std::this_thread::yield();
+    }
+    if (call.error)
+        std::rethrow_exception(call.error);
+}
+
+void parallelFor(ThreadPool* threadPool, int count, const std::function<void(int)>& func)
+{
+    if (threadPool) {
+        threadPool->parallelFor(count, func);
+    } else {
+        for (int i = 0; i < count; i++)
+            func(i);
+    }
+}
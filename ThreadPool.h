@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Each worker owns a queue, it pops its own tasks
+// from the back and steals from the front of the other queues when empty.
+// Threads that are not workers share an extra queue.
+class ThreadPool {
+
+  public:
+    // numThreads counts the calling thread, so 1 runs everything inline
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    int size() const { return (int)_threads.size() + 1; }
+
+    // Run func(i) for every i in [0, count) and return once they are all
+    // done. The calling thread executes tasks while waiting, so this can be
+    // called from inside a task. The first exception thrown by func is
+    // rethrown once every task has finished, the tasks not started yet are
+    // skipped.
+    void parallelFor(int count, const std::function<void(int)>& func);
+
+  private:
+    // state of one parallelFor call, shared by its tasks
+    struct Call {
+        const std::function<void(int)>* func;
+        std::atomic<int> pending;
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+    };
+
+    struct Task {
+        Call* call;
+        int index;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    int currentQueue() const;
+    bool popTask(int queueIndex, Task& task);
+    bool runOneTask(int queueIndex);
+    void workerLoop(int queueIndex);
+
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::atomic<int> _queuedTasks;
+    std::mutex _sleepMutex;
+    std::condition_variable _sleepCondition;
+    bool _stop;
+};
+
+// threadPool->parallelFor, or func(i) for every i in order on the calling
+// thread when threadPool is null
+void parallelFor(ThreadPool* threadPool, int count, const std::function<void(int)>& func);
@@ -0,0 +1,195 @@
+#include "Triangles.h"
+
+#include <algorithm>
+#include <math.h>
+
+// Parameters of the Forsyth scoring, from "Linear-Speed Vertex Cache Optimisation"
+static const int CacheSize = 32;
+static const float CacheDecayPower = 1.5f;
+static const float LastTriangleScore = 0.75f;
+static const float ValenceBoostScale = 2.0f;
+static const float ValenceBoostPower = 0.5f;
+
+static float vertexScore(int cachePosition, int remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // the triangle just added is rendered from the same 3 vertexes
+        if (cachePosition < 3) {
+            score = LastTriangleScore;
+        } else {
+            float scale = 1.0f / (CacheSize - 3);
+            score = powf(1.0f - (cachePosition - 3) * scale, CacheDecayPower);
+        }
+    }
+
+    // vertexes with few triangles left are finished first
+    score += ValenceBoostScale * powf((float)remainingTriangles, -ValenceBoostPower);
+    return score;
+}
+
+static void optimizeVertexCache(std::vector<uint32_t>& order, const std::vector<uint32_t>& indexes,
+                                size_t numVertexes)
+{
+    size_t numTriangles = indexes.size() / 3;
+
+    // triangles of each vertex, the ones still to add first
+    std::vector<uint32_t> offsets(numVertexes + 1, 0);
+    for (uint32_t index : indexes)
+        offsets[index + 1]++;
+    for (size_t i = 0; i < numVertexes; i++)
+        offsets[i + 1] += offsets[i];
+    std::vector<uint32_t> remaining(numVertexes, 0);
+    std::vector<uint32_t> adjacency(indexes.size());
+    for (size_t i = 0; i < indexes.size(); i++) {
+        uint32_t vertex = indexes[i];
+        adjacency[offsets[vertex] + remaining[vertex]++] = i / 3;
+    }
+
+    std::vector<int> cachePositions(numVertexes, -1);
+    std::vector<float> vertexScores(numVertexes);
+    for (size_t i = 0; i < numVertexes; i++)
+        vertexScores[i] = vertexScore(-1, remaining[i]);
+
+    std::vector<float> triangleScores(numTriangles);
+    std::vector<bool> added(numTriangles, false);
+    int best = -1;
+    float bestScore = -1.0f;
+    for (size_t t = 0; t < numTriangles; t++) {
+        const uint32_t* triangle = &indexes[t * 3];
+        triangleScores[t] = vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+        if (triangleScores[t] > bestScore) {
+            bestScore = triangleScores[t];
+            best = t;
+        }
+    }
+
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> nextCache;
+    cache.reserve(CacheSize + 3);
+    nextCache.reserve(CacheSize + 3);
+    size_t cursor = 0;
+    order.clear();
+    order.reserve(numTriangles);
+    while (order.size() < numTriangles) {
+        // nothing left around the cache, restart from the next triangle to add
+        if (best < 0) {
+            while (added[cursor])
+                cursor++;
+            best = cursor;
+        }
+
+        order.push_back(best);
+        added[best] = true;
+        const uint32_t* triangle = &indexes[best * 3];
+
+        nextCache.clear();
+        for (int j = 0; j < 3; j++) {
+            uint32_t vertex = triangle[j];
+            nextCache.push_back(vertex);
+
+            uint32_t* begin = &adjacency[offsets[vertex]];
+            uint32_t* end = begin + remaining[vertex];
+            std::iter_swap(std::find(begin, end, (uint32_t)best), end - 1);
+            remaining[vertex]--;
+        }
+        for (uint32_t vertex : cache) {
+            if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+                nextCache.push_back(vertex);
+        }
+
+        // vertexes pushed out of the cache are scored too
+        for (size_t i = 0; i < nextCache.size(); i++) {
+            uint32_t vertex = nextCache[i];
+            cachePositions[vertex] = i < (size_t)CacheSize ? (int)i : -1;
+            vertexScores[vertex] = vertexScore(cachePositions[vertex], remaining[vertex]);
+        }
+
+        best = -1;
+        bestScore = -1.0f;
+        for (uint32_t vertex : nextCache) {
+            for (uint32_t i = offsets[vertex]; i < offsets[vertex] + remaining[vertex]; i++) {
+                uint32_t t = adjacency[i];
+                const uint32_t* other = &indexes[t * 3];
+                triangleScores[t] = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+                if (triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+
+        if (nextCache.size() > (size_t)CacheSize)
+            nextCache.resize(CacheSize);
+        cache.swap(nextCache);
+    }
+}
+
+void triangulate(TriangleList& list, const VoxelBuffer& buffer, bool optimize)
+{
+    size_t numFaces = buffer.numFaces();
+    size_t numVertexes = buffer.numVertexes();
+    std::vector<uint32_t> indexes;
+    indexes.reserve(numFaces * 6);
+    for (size_t i = 0; i < numFaces; i++) {
+        Face face = buffer.face(i);
+        uint32_t triangles[6] = {(uint32_t)face[0], (uint32_t)face[1], (uint32_t)face[2],
+                                 (uint32_t)face[0], (uint32_t)face[2], (uint32_t)face[3]};
+        indexes.insert(indexes.end(), triangles, triangles + 6);
+    }
+
+    std::vector<uint32_t> order;
+    if (optimize) {
+        optimizeVertexCache(order, indexes, numVertexes);
+    } else {
+        order.resize(numFaces * 2);
+        for (size_t t = 0; t < order.size(); t++)
+            order[t] = t;
+    }
+
+    // vertexes are numbered by first use so they are fetched in order
+    std::vector<uint32_t> remap(numVertexes, UINT32_MAX);
+    list.indexes.resize(indexes.size());
+    list.faces.resize(order.size());
+    list.vertexes.clear();
+    for (size_t t = 0; t < order.size(); t++) {
+        list.faces[t] = order[t] / 2;
+        for (int j = 0; j < 3; j++) {
+            uint32_t vertex = indexes[order[t] * 3 + j];
+            if (optimize) {
+                if (remap[vertex] == UINT32_MAX) {
+                    remap[vertex] = list.vertexes.size();
+                    list.vertexes.push_back(vertex);
+                }
+                vertex = remap[vertex];
+            }
+            list.indexes[t * 3 + j] = vertex;
+        }
+    }
+
+    if (!optimize) {
+        list.vertexes.resize(numVertexes);
+        for (size_t i = 0; i < numVertexes; i++)
+            list.vertexes[i] = i;
+    }
+}
+
+float averageCacheMissRatio(const std::vector<uint32_t>& indexes, size_t numVertexes, int cacheSize)
+{
+    if (indexes.empty())
+        return 0.0f;
+
+    // a vertex is in the cache while fewer than cacheSize misses followed its own
+    std::vector<uint64_t> missTime(numVertexes, 0);
+    uint64_t misses = 0;
+    for (uint32_t vertex : indexes) {
+        if (missTime[vertex] == 0 || misses - missTime[vertex] >= (uint64_t)cacheSize) {
+            misses++;
+            missTime[vertex] = misses;
+        }
+    }
+    return (float)misses / (indexes.size() / 3);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "polygonize.h"
+
+#include <cstdint>
+#include <vector>
+
+// Triangles of a VoxelBuffer as written to a file. vertexes[i] is the buffer
+// vertex written at position i, faces[t] the quad triangle t comes from and
+// indexes refer to the written vertexes, three per triangle.
+struct TriangleList {
+    std::vector<uint32_t> indexes;
+    std::vector<uint32_t> vertexes;
+    std::vector<uint32_t> faces;
+};
+
+// Splits every quad along its 0-2 diagonal, keeping the winding, the split the
+// glTF output always used. When optimize is set the triangles are reordered
+// for the post transform vertex cache of GPUs, with the method of Tom Forsyth,
+// and the vertexes renumbered in the order the triangles first use them.
+void triangulate(TriangleList& list, const VoxelBuffer& buffer, bool optimize);
+
+// Average number of vertexes transformed per triangle with a FIFO cache of
+// cacheSize vertexes, 0.5 is ideal and 3 the worst
+float averageCacheMissRatio(const std::vector<uint32_t>& indexes, size_t numVertexes, int cacheSize);
@@ -1,96 +1,101 @@
 #include "VoxReader.h"
+#include "Log.h"
 
+#include <algorithm>
 #include <bitset>
 #include <cstring>
-#include <fstream>
+#include <new>
 #include <stdio.h>
 
-typedef std::map<std::string, std::string> VoxDict;
-typedef std::pair<std::string, std::string> string_pair;
-typedef std::pair<std::string, float> string_float_pair;
-
 #ifdef DEBUG
 static void print(const VoxTransform& o)
 {
-    printf("-----VoxTransform --- : %d\n", o.nodeId);
-    printf("    -- nodeId : %d\n", o.nodeId);
-    printf("    -- name : %s\n", o.name.c_str());
-    printf("    -- hidden : %d\n", o.hidden);
-    printf("    -- childNodeId : %d\n", o.childNodeId);
-    printf("    -- reservedId : %d\n", o.reservedId);
-    printf("    -- layerId : %d\n", o.layerId);
-    printf("    -- numFrames : %d\n", o.numFrames);
+    std::string text = "-----VoxTransform --- : " + std::to_string(o.nodeId) + "\n";
+    text += "    -- nodeId : " + std::to_string(o.nodeId) + "\n";
+    text += "    -- name : " + o.name.str() + "\n";
+    text += "    -- hidden : " + std::to_string(o.hidden) + "\n";
+    text += "    -- childNodeId : " + std::to_string(o.childNodeId) + "\n";
+    text += "    -- reservedId : " + std::to_string(o.reservedId) + "\n";
+    text += "    -- layerId : " + std::to_string(o.layerId) + "\n";
+    text += "    -- numFrames : " + std::to_string(o.numFrames) + "\n";
 
     for (int i = 0; i < o.numFrames; ++i) {
-        printf(" ++ FRAME ++ \n");
-        printf("    + Translation %d %d %d\n", o.initialFrame.translation[0], o.initialFrame.translation[1],
-               o.initialFrame.translation[2]);
+        const VoxTransform::Frame& frame = o.frames[i];
+        text += " ++ FRAME " + std::to_string(frame.index) + " ++ \n";
+        text += "    + Translation " + std::to_string(frame.translation[0]) + " " +
+                std::to_string(frame.translation[1]) + " " + std::to_string(frame.translation[2]) + "\n";
 
-        printf("    + rotation ");
+        text += "    + rotation ";
         for (unsigned int r = 0; r < 9; ++r) {
-            printf("%f ", o.initialFrame.rotation[r]);
+            text += std::to_string(frame.rotation[r]) + " ";
         }
-        printf(" ++++++ \n");
+        text += " ++++++ \n";
     }
 
-    printf("\n\n");
+    logMessage(LOG_DEBUG, "%s\n\n", text.c_str());
 }
 
 static void print(const VoxGroup& o)
 {
-    printf("-----VoxGroup --- : \n");
-    printf("    -- nodeId : %d\n", o.nodeId);
-    printf("    -- name : %s\n", o.name.c_str());
-    printf("    -- hidden : %d\n", o.hidden);
-    printf("    -- childNodeId : %d\n", o.numChildren);
+    std::string text = "-----VoxGroup --- : \n";
+    text += "    -- nodeId : " + std::to_string(o.nodeId) + "\n";
+    text += "    -- name : " + o.name.str() + "\n";
+    text += "    -- hidden : " + std::to_string(o.hidden) + "\n";
+    text += "    -- childNodeId : " + std::to_string(o.numChildren) + "\n";
 
     if (o.numChildren) {
-        printf("[ %d", o.children[0]);
+        text += "[ " + std::to_string(o.children[0]);
         for (int i = 1; i < o.numChildren; ++i) {
-            printf(", %d", o.children[i]);
+            text += ", " + std::to_string(o.children[i]);
         }
-        printf(" ]\n\n");
+        text += " ]\n\n";
     }
+    logMessage(LOG_DEBUG, "%s", text.c_str());
 }
 
 static void print(const VoxShape& o)
 {
-    printf("-----VoxShape --- : \n");
-    printf("    -- nodeId : %d\n", o.nodeId);
-    printf("    -- name : %s\n", o.name.c_str());
-    printf("    -- hidden : %d\n", o.hidden);
-    printf("    -- numModels : %d\n", o.numModels);
+    std::string text = "-----VoxShape --- : \n";
+    text += "    -- nodeId : " + std::to_string(o.nodeId) + "\n";
+    text += "    -- name : " + o.name.str() + "\n";
+    text += "    -- hidden : " + std::to_string(o.hidden) + "\n";
+    text += "    -- numModels : " + std::to_string(o.numModels) + "\n";
 
-    printf("[ ");
+    text += "[ ";
 
-    for (auto m = o.models.begin(); m != o.models.end(); ++m) {
-        printf("[%d => %s .. %s], ", m->first, m->second.first.c_str(), m->second.second.c_str());
+    for (int i = 0; i < o.numModels; ++i) {
+        text += std::to_string(o.models[i].modelId) + " from " + std::to_string(o.models[i].frame) + ", ";
     }
 
-    printf("]\n\n");
+    logMessage(LOG_DEBUG, "%s]\n\n", text.c_str());
 }
 
 static void print(const VoxScene& o)
 {
-    printf("Scene: \n");
-    printf(" Size: %d %d %d\n", o.sizeX, o.sizeY, o.sizeZ);
-    printf("  - Voxels: %lu\n", o.voxels.size());
-    printf("  - Palette: %lu\n", o.palettes.size());
-    printf("  - Materials: %lu\n", o.materials.size());
-    printf("  - Groups: %lu\n", o.groups.size());
-    printf("  - Transforms: %lu\n", o.transforms.size());
-    printf("  - Shapes: %lu\n", o.shapes.size());
-    printf("-------------\n");
+    logMessage(LOG_DEBUG,
+               "Scene: \n Size: %d %d %d\n  - Voxels: %lu\n  - Palette: %lu\n  - Materials: %lu\n  - Groups: %lu\n"
+               "  - Transforms: %lu\n  - Shapes: %lu\n-------------\n",
+               o.sizeX, o.sizeY, o.sizeZ, o.voxels.size(), o.palettes.size(), o.materials.size(), o.groups.size(),
+               o.transforms.size(), o.shapes.size());
 }
 #endif
 
-bool isSupportedChunk(const std::string& chunkName)
+static inline uint32_t fourCC(const char* name)
 {
-    return true;
-    return (chunkName == "MAIN" || chunkName == "SIZE" || chunkName == "XYZI" || chunkName == "RGBA" ||
-            chunkName == "nGRP" || chunkName == "nTRN" || chunkName == "nSHP");
+    uint32_t id;
+    memcpy(&id, name, 4);
+    return id;
 }
 
+static const uint32_t CHUNK_MAIN = fourCC("MAIN");
+static const uint32_t CHUNK_SIZE = fourCC("SIZE");
+static const uint32_t CHUNK_XYZI = fourCC("XYZI");
+static const uint32_t CHUNK_RGBA = fourCC("RGBA");
+static const uint32_t CHUNK_MATL = fourCC("MATL");
+static const uint32_t CHUNK_nTRN = fourCC("nTRN");
+static const uint32_t CHUNK_nGRP = fourCC("nGRP");
+static const uint32_t CHUNK_nSHP = fourCC("nSHP");
+
 static std::string readChunk(const uint8_t* bytes)
 {
     char chunkId[4];
@@ -98,120 +103,345 @@ static std::string readChunk(const uint8_t* bytes)
     return std::string(reinterpret_cast<const char*>(&chunkId[0]), 4);
 }
 
-bool VoxReader::decodeChunk(const std::string& chunkName, const uint8_t* content, unsigned int size)
-{
-    if (chunkName == "SIZE") {
-        decodeSizeChunk(content);
-    } else if (chunkName == "XYZI") {
-        decodePosChunk(content);
-    } else if (chunkName == "LAYR") {
-        printf("- Unsupported LAYR (no spec)\n");
-    } else if (chunkName == "RGBA") {
-        decodePaletteChunk(content, size);
-    } else if (chunkName == "MATL") {
-        decodeMaterialChunk(content);
-    } else if (chunkName == "rOBJ") {
-        printf("- Unsupported rOBJ (no spec)\n");
-    } else if (chunkName == "nTRN") {
-        decodeTransform(content);
-    } else if (chunkName == "nGRP") {
-        decodeGroup(content);
-    } else if (chunkName == "nSHP") {
-        decodeShape(content);
+// Chunks are walked in file order, children being read right after the
+// content of their parent. The stack only keeps the end of the enclosing
+// chunks to check that every chunk fits in its parent. Only the chunks we
+// decode are indexed, reading no more than the few bytes giving model sizes
+// and node ids.
+bool VoxReader::readChunks(const uint8_t* bytes, size_t size)
+{
+    std::vector<size_t> ends;
+    ends.push_back(size);
+
+    uint32_t modelSize[3] = {0, 0, 0};
+    size_t pos = 0;
+    while (pos < size) {
+        while (ends.size() > 1 && pos >= ends.back())
+            ends.pop_back();
+        size_t end = ends.back();
+
+        if (end - pos < 12) {
+            logMessage(LOG_ERROR, "Truncated chunk header at %lu\n", (unsigned long)pos);
+            return false;
+        }
+
+        uint32_t id;
+        uint32_t chunkContentSize;
+        uint32_t childChunkContentSize;
+        memcpy(&id, bytes + pos, 4);
+        memcpy(&chunkContentSize, bytes + pos + 4, 4);
+        memcpy(&childChunkContentSize, bytes + pos + 8, 4);
+
+        size_t available = end - pos - 12;
+        if (chunkContentSize > available || childChunkContentSize > available - chunkContentSize) {
+            logMessage(LOG_ERROR, "Chunk %s at %lu does not fit in its parent\n",
+                       ::readChunk(bytes + pos).c_str(), (unsigned long)pos);
+            return false;
+        }
+        pos += 12;
+
+        VoxChunk chunk = {id, (uint32_t)(bytes + pos - _data), chunkContentSize};
+        const uint8_t* content = bytes + pos;
+        if (id == CHUNK_SIZE) {
+            if (!decodeSizeChunk(content, chunkContentSize, modelSize)) {
+                logMessage(LOG_ERROR, "Invalid SIZE chunk\n");
+                return false;
+            }
+            _chunks.push_back(chunk);
+        } else if (id == CHUNK_XYZI) {
+            VoxModelInfo info = {modelSize[0], modelSize[1], modelSize[2], 0, (int)_chunks.size()};
+            if (chunkContentSize >= 4)
+                memcpy(&info.numVoxels, content, 4);
+            if (chunkContentSize < 4 || info.numVoxels > (chunkContentSize - 4) / 4) {
+                logMessage(LOG_ERROR, "Invalid XYZI chunk\n");
+                return false;
+            }
+            _models.push_back(info);
+            _chunks.push_back(chunk);
+        } else if (id == CHUNK_RGBA) {
+            _paletteChunk = _chunks.size();
+            _chunks.push_back(chunk);
+        } else if (id == CHUNK_MATL) {
+            _chunks.push_back(chunk);
+        } else if (id == CHUNK_nTRN || id == CHUNK_nGRP || id == CHUNK_nSHP) {
+            if (chunkContentSize < 4) {
+                logMessage(LOG_ERROR, "Invalid node chunk\n");
+                return false;
+            }
+            Node node = {0, (int)_chunks.size(), nullptr, false};
+            memcpy(&node.nodeId, content, 4);
+            _nodes.push_back(node);
+            _chunks.push_back(chunk);
+        } else if (id != CHUNK_MAIN) {
+#ifdef DEBUG
+            logMessage(LOG_DEBUG, "- Unsupported chunk %s\n", ::readChunk(bytes + pos - 12).c_str());
+#endif
+        }
+
+        pos += chunkContentSize;
+        if (childChunkContentSize > 0)
+            ends.push_back(pos + childChunkContentSize);
     }
+    return true;
+}
 
+bool VoxReader::decodeSizeChunk(const uint8_t* content, unsigned int size, uint32_t* dimensions)
+{
+    if (size < 12)
+        return false;
+    memcpy(dimensions, content, 12);
     return true;
 }
 
-void VoxReader::readChunk(const uint8_t* bytes, unsigned int size)
+bool VoxReader::readFile(const std::string& filename) { return openFile(filename) && decodeAll(); }
+
+bool VoxReader::loadVoxelsData(const uint8_t* bytes, size_t size)
 {
+    return indexVoxelsData(bytes, size) && decodeAll();
+}
 
-    std::string chunkName = ::readChunk(bytes);
+bool VoxReader::openFile(const std::string& filename)
+{
+    // decoding reads straight from the mapping, which stays open with the reader
+    if (!_file.open(filename)) {
+        logMessage(LOG_ERROR, "Failed to open file\n");
+        return false;
+    }
 
-    uint32_t chunkContentSize = *((uint32_t*)(bytes + 4));
-    uint32_t childChunkContentSize = *((uint32_t*)(bytes + 8));
+    return indexVoxelsData(_file.data(), _file.size());
+}
 
-    if (!isSupportedChunk(chunkName)) {
-        printf("Unsupported chunk %s\n", chunkName.c_str());
-    } else {
-        if (chunkContentSize > 0) {
-            uint8_t chunkContent[chunkContentSize];
-            memcpy(&chunkContent, bytes + 12, chunkContentSize);
-            decodeChunk(chunkName, &chunkContent[0], chunkContentSize);
-        }
+bool VoxReader::indexVoxelsData(const uint8_t* bytes, size_t size)
+{
+    _data = bytes;
+    _chunks.clear();
+    _models.clear();
+    _nodes.clear();
+    _paletteChunk = -1;
+    _materialsLoaded = false;
+    _failed = false;
+    _arena.clear();
+    _voxScene = VoxScene();
+
+    if (size < 20 || bytes[0] != 'V' || bytes[1] != 'O' || bytes[2] != 'X' || bytes[3] != ' ') {
+        logMessage(LOG_ERROR, "It's not a vox file!\n");
+        return false;
+    }
 
-        if (childChunkContentSize > 0) {
-            uint8_t childChunkContent[childChunkContentSize];
-            memcpy(&childChunkContent, bytes + 12 + chunkContentSize, childChunkContentSize);
-            readChunk(&childChunkContent[0], childChunkContentSize);
-        }
+#ifdef DEBUG
+    int version;
+    memcpy(&version, bytes + 4, 4);
+    logMessage(LOG_DEBUG, "Version: %d\n", version);
+#endif
+
+    std::string chunkIdStr = ::readChunk(bytes + 8);
+
+    if (strcmp(chunkIdStr.c_str(), "MAIN") != 0) {
+        logMessage(LOG_ERROR, "No main chunk found, aborting.\n");
+        return false;
+    }
 
-        // Chunk is read, now read the rest of the data
-        int remainingSize = size - 12 - chunkContentSize - childChunkContentSize;
-        if (remainingSize > 0) {
-            readChunk(&bytes[12 + chunkContentSize + childChunkContentSize], remainingSize);
+    if (!readChunks(bytes + 8, size - 8))
+        return false;
+
+    // nodes are written in id order, a repeated id keeps its last chunk
+    std::stable_sort(_nodes.begin(), _nodes.end(),
+                     [](const Node& a, const Node& b) { return a.nodeId < b.nodeId; });
+    size_t numNodes = 0;
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        if (numNodes && _nodes[numNodes - 1].nodeId == _nodes[i].nodeId)
+            numNodes--;
+        _nodes[numNodes++] = _nodes[i];
+    }
+    _nodes.resize(numNodes);
+
+    _voxScene.voxels.resize(_models.size());
+    _modelLoaded.assign(_models.size(), false);
+    return true;
+}
+
+const VoxModel& VoxReader::getModel(int index)
+{
+    if (!_modelLoaded[index]) {
+        const VoxChunk& chunk = _chunks[_models[index].chunk];
+        // a truncated model is left empty and fails the reader
+        if (!decodePosChunk(chunkContent(chunk), chunk.size, _voxScene.voxels[index])) {
+            logMessage(LOG_ERROR, "error decoding model %d\n", index);
+            _failed = true;
         }
+        _modelLoaded[index] = true;
     }
+    return _voxScene.voxels[index];
 }
 
-bool VoxReader::decodeSizeChunk(const uint8_t* content)
+bool VoxReader::readModel(int index, VoxModel& voxels) const
 {
-    memcpy(&_voxScene.sizeX, content, 4);
-    memcpy(&_voxScene.sizeY, content + 4, 4);
-    memcpy(&_voxScene.sizeZ, content + 8, 4);
-    return true;
+    const VoxChunk& chunk = _chunks[_models[index].chunk];
+    return decodePosChunk(chunkContent(chunk), chunk.size, voxels);
 }
 
-bool VoxReader::readFile(const std::string& filename)
+const VoxPalette* VoxReader::getPalette()
 {
-    FILE* fp = fopen(filename.c_str(), "rb");
-    if (!fp) {
-        printf("Failed to open file\n");
-        return false;
+    if (_paletteChunk < 0)
+        return nullptr;
+
+    if (_voxScene.palettes.empty()) {
+        const VoxChunk& chunk = _chunks[_paletteChunk];
+        _voxScene.palettes.push_back(VoxPalette());
+        decodePaletteChunk(chunkContent(chunk), chunk.size, _voxScene.palettes.back());
     }
-    fseek(fp, 0, SEEK_END);
+    return &_voxScene.palettes.back();
+}
 
-    int size = ftell(fp);
-    if (size == 0) {
-        printf("File is empty\n");
-        return false;
+const std::map<int, VoxMaterial>& VoxReader::getMaterials()
+{
+    if (!_materialsLoaded) {
+        for (const VoxChunk& chunk : _chunks) {
+            if (chunk.id == CHUNK_MATL) {
+                VoxMaterial material;
+                int materialId;
+                if (!decodeMaterialChunk(chunkContent(chunk), chunk.size, materialId, material)) {
+                    logMessage(LOG_ERROR, "Invalid MATL chunk\n");
+                    _failed = true;
+                    continue;
+                }
+                _voxScene.materials[materialId] = material;
+            }
+        }
+        _materialsLoaded = true;
     }
+    return _voxScene.materials;
+}
+
+VoxReader::Node* VoxReader::findNode(int nodeId, uint32_t chunkId)
+{
+    std::vector<Node>::iterator it = std::lower_bound(_nodes.begin(), _nodes.end(), nodeId,
+                                                      [](const Node& node, int id) { return node.nodeId < id; });
+    if (it == _nodes.end() || it->nodeId != nodeId || _chunks[it->chunk].id != chunkId)
+        return nullptr;
+    return &*it;
+}
 
-    std::vector<uint8_t> buf(size);
+// the node is then left out of the scene, and decoding reported failed
+void VoxReader::malformedNode(Node& node)
+{
+    logMessage(LOG_ERROR, "Invalid %s chunk of node %d\n", ::readChunk((const uint8_t*)&_chunks[node.chunk].id).c_str(),
+               node.nodeId);
+    node.malformed = true;
+    _failed = true;
+}
 
-    fseek(fp, 0, SEEK_SET);
-    fread(&buf[0], size, 1, fp);
-    fclose(fp);
+// Nodes are decoded once in the arena
+const VoxTransform* VoxReader::getTransform(int nodeId)
+{
+    Node* node = findNode(nodeId, CHUNK_nTRN);
+    if (!node || node->malformed)
+        return nullptr;
+
+    if (!node->decoded) {
+        const VoxChunk& chunk = _chunks[node->chunk];
+        VoxTransform* transform = new (_arena.allocate<VoxTransform>(1)) VoxTransform();
+        if (!decodeTransform(chunkContent(chunk), chunk.size, *transform, _arena)) {
+            malformedNode(*node);
+            return nullptr;
+        }
+        node->decoded = transform;
+    }
+    return static_cast<const VoxTransform*>(node->decoded);
+}
 
-    return loadVoxelsData(&buf[0], size);
+const VoxGroup* VoxReader::getGroup(int nodeId)
+{
+    Node* node = findNode(nodeId, CHUNK_nGRP);
+    if (!node || node->malformed)
+        return nullptr;
+
+    if (!node->decoded) {
+        const VoxChunk& chunk = _chunks[node->chunk];
+        VoxGroup* group = new (_arena.allocate<VoxGroup>(1)) VoxGroup();
+        if (!decodeGroup(chunkContent(chunk), chunk.size, *group, _arena)) {
+            malformedNode(*node);
+            return nullptr;
+        }
+        node->decoded = group;
+    }
+    return static_cast<const VoxGroup*>(node->decoded);
 }
 
-bool VoxReader::loadVoxelsData(const uint8_t* bytes,
-                               size_t size) // ADD structure
+const VoxShape* VoxReader::getShape(int nodeId)
 {
-    if (bytes[0] != 'V' || bytes[1] != 'O' || bytes[2] != 'X' || bytes[3] != ' ') {
-        printf("It's not a vox file!\n");
-        return false;
+    Node* node = findNode(nodeId, CHUNK_nSHP);
+    if (!node || node->malformed)
+        return nullptr;
+
+    if (!node->decoded) {
+        const VoxChunk& chunk = _chunks[node->chunk];
+        VoxShape* shape = new (_arena.allocate<VoxShape>(1)) VoxShape();
+        if (!decodeShape(chunkContent(chunk), chunk.size, *shape, _arena)) {
+            malformedNode(*node);
+            return nullptr;
+        }
+        node->decoded = shape;
     }
+    return static_cast<const VoxShape*>(node->decoded);
+}
 
-    int version;
-    memcpy(&version, bytes + 4, 4);
-    printf("Version: %d\n", version);
+// the scene keeps its own copy of the strings of the data
+static void keepString(VoxString& string, Arena& arena)
+{
+    string.data = arena.copy(string.data, string.size);
+}
 
-    std::string chunkIdStr = ::readChunk(bytes + 8);
-    printf("ChunkId: %s\n", chunkIdStr.c_str());
+bool VoxReader::decodeAll()
+{
+    for (int i = 0; i < getNumModels(); i++)
+        getModel(i);
+    if (!_models.empty()) {
+        _voxScene.sizeX = _models.back().sizeX;
+        _voxScene.sizeY = _models.back().sizeY;
+        _voxScene.sizeZ = _models.back().sizeZ;
+    }
 
-    if (strcmp(chunkIdStr.c_str(), "MAIN") == 0) {
-        readChunk(&bytes[8], size - 12);
-    } else {
-        printf("No main chunk found, aborting.\n");
-        return false;
+    getPalette();
+    getMaterials();
+
+    Arena& arena = _voxScene.arena;
+    for (const VoxChunk& chunk : _chunks) {
+        const uint8_t* content = chunkContent(chunk);
+        bool decoded = true;
+        if (chunk.id == CHUNK_nTRN) {
+            _voxScene.transforms.push_back(VoxTransform());
+            decoded = decodeTransform(content, chunk.size, _voxScene.transforms.back(), arena);
+            keepString(_voxScene.transforms.back().name, arena);
+        } else if (chunk.id == CHUNK_nGRP) {
+            _voxScene.groups.push_back(VoxGroup());
+            decoded = decodeGroup(content, chunk.size, _voxScene.groups.back(), arena);
+            keepString(_voxScene.groups.back().name, arena);
+        } else if (chunk.id == CHUNK_nSHP) {
+            _voxScene.shapes.push_back(VoxShape());
+            decoded = decodeShape(content, chunk.size, _voxScene.shapes.back(), arena);
+            keepString(_voxScene.shapes.back().name, arena);
+        }
+        if (!decoded) {
+            logMessage(LOG_ERROR, "Invalid %s chunk\n", ::readChunk((const uint8_t*)&chunk.id).c_str());
+            _failed = true;
+            return false;
+        }
     }
 
 #ifdef DEBUG
     print(_voxScene);
 #endif
-    return true;
+    return !_failed;
+}
+
+void VoxReader::takeVoxelScene(VoxScene& scene)
+{
+    scene = std::move(_voxScene);
+    _voxScene = VoxScene();
+    _voxScene.voxels.resize(_models.size());
+    _modelLoaded.assign(_models.size(), false);
+    _materialsLoaded = false;
 }
 
 static void decodeRotation(const uint8_t rotation, float* values)
@@ -222,36 +452,95 @@ static void decodeRotation(const uint8_t rotation, float* values)
     float signed2 = rotation & (1 << 5) ? -1 : 1;
     float signed3 = rotation & (1 << 6) ? -1 : 1;
 
+    // rows 1 and 2 store the column of their non zero entry, row 3 takes the last one
     int index1 = rotation & 3;
     int index2 = (rotation >> 2) & 3;
-    int index3 = 0;
-
-    if (index1 == 0 || index2 == 0) {
-        index3 = 1;
-        if (index2 == 1 || index2 == 1)
-            index3 = 2;
-    }
+    int index3 = 3 - index1 - index2;
 
     values[index1] = signed1;
     values[3 + index2] = signed2;
     values[6 + index3] = signed3;
 }
 
-uint32_t VoxReader::decodeInt(const uint8_t* content, int& currentPos)
+// Reads of the content of a chunk fail rather than go past its size, the
+// file is not trusted
+bool VoxReader::decodeInt(const uint8_t* content, uint32_t size, uint32_t& currentPos, int& value)
 {
-    uint32_t value;
+    if (size - currentPos < 4)
+        return false;
     memcpy(&value, &content[currentPos], 4);
     currentPos += 4;
-    return value;
+    return true;
+}
+
+bool VoxReader::decodeString(const uint8_t* content, uint32_t size, uint32_t& currentPos, VoxString& string)
+{
+    uint32_t length;
+    if (size - currentPos < 4)
+        return false;
+    memcpy(&length, &content[currentPos], 4);
+    if (size - currentPos - 4 < length)
+        return false;
+    string.data = (const char*)&content[currentPos + 4];
+    string.size = length;
+    currentPos += 4 + length;
+    return true;
+}
+
+// a count of entries taking at least entrySize bytes each, rejected when they
+// cannot fit in the rest of the chunk
+bool VoxReader::decodeCount(const uint8_t* content, uint32_t size, uint32_t& currentPos, uint32_t entrySize,
+                            int& count)
+{
+    return decodeInt(content, size, currentPos, count) && count >= 0 &&
+           (uint32_t)count <= (size - currentPos) / entrySize;
+}
+
+// DICT of node attributes, the name and hidden flag are kept
+static const uint32_t DictEntrySize = 8;
+
+bool VoxReader::decodeNodeAttributes(const uint8_t* content, uint32_t size, uint32_t& currentPos, VoxString& name,
+                                     bool& hidden)
+{
+    int keyvalpair;
+    if (!decodeCount(content, size, currentPos, DictEntrySize, keyvalpair))
+        return false;
+    for (int i = 0; i < keyvalpair; ++i) {
+        VoxString key;
+        VoxString value;
+        if (!decodeString(content, size, currentPos, key) || !decodeString(content, size, currentPos, value))
+            return false;
+        if (key == "_name") {
+            name = value;
+        } else if (key == "_hidden") {
+            hidden = value == "1";
+        }
+    }
+    return true;
 }
 
-std::string VoxReader::decodeString(const uint8_t* content, int& currentPos)
+// Numbers of a string value, parsed from a terminated copy. Those of vox files
+// are a few characters long.
+static int parseInts(const VoxString& value, int* values, int count)
 {
-    uint32_t size;
-    memcpy(&size, &content[currentPos], 4);
-    std::string strVal((char*)&content[currentPos + 4], size);
-    currentPos += 4 + size;
-    return strVal;
+    char text[64];
+    size_t size = std::min<size_t>(value.size, sizeof(text) - 1);
+    memcpy(text, value.data, size);
+    text[size] = 0;
+
+    char* cursor = text;
+    for (int i = 0; i < count; i++)
+        values[i] = strtol(cursor, &cursor, 10);
+    return count;
+}
+
+static float parseFloat(const VoxString& value)
+{
+    char text[64];
+    size_t size = std::min<size_t>(value.size, sizeof(text) - 1);
+    memcpy(text, value.data, size);
+    text[size] = 0;
+    return strtof(text, nullptr);
 }
 
 /*
@@ -265,82 +554,64 @@ DICT    : node attributes
 int32   : child node id
 int32   : reserved id (must be -1)
 int32   : layer id
-int32   : num of frames (must be 1)
+int32   : num of frames
 
 // for each frame
 {
 DICT    : frame attributes
       (_r : int8) ROTATION, see (c)
       (_t : int32x3) translation
+      (_f : int32) animation frame, the index of the frame when missing
 }xN*/
 
-struct TransformTranslate {
-    TransformTranslate()
-        : v{0, 0, 0}
-    {}
-    int32_t v[3];
-    inline int32_t& operator[](int index) { return v[index]; }
-    inline int32_t operator[](int index) const { return v[index]; }
-};
-
-static TransformTranslate convertStringToVec3(const std::string& vectorString)
-{
-    TransformTranslate vector;
-    std::size_t current, previous = 0;
-
-    current = vectorString.find(' ');
-    for (unsigned int i = 0; i < 3; ++i) {
-        vector[i] = stoi(vectorString.substr(previous, current - previous));
-        previous = current + 1;
-        current = vectorString.find(' ', previous);
-    }
-
-    return vector;
-}
-
-void VoxReader::decodeTransform(const uint8_t* content)
+bool VoxReader::decodeTransform(const uint8_t* content, uint32_t size, VoxTransform& transform, Arena& arena)
 {
-    VoxTransform transform;
-
-    int currentPos = 0;
-    transform.nodeId = decodeInt(content, currentPos);
+    uint32_t currentPos = 0;
+    int numFrames;
+    if (!decodeInt(content, size, currentPos, transform.nodeId) ||
+        !decodeNodeAttributes(content, size, currentPos, transform.name, transform.hidden) ||
+        !decodeInt(content, size, currentPos, transform.childNodeId) ||
+        !decodeInt(content, size, currentPos, transform.reservedId) ||
+        !decodeInt(content, size, currentPos, transform.layerId) ||
+        !decodeCount(content, size, currentPos, 4, numFrames))
+        return false;
 
-    // DICT: get keyval pair
-    int keyvalpair = decodeInt(content, currentPos);
-    for (int i = 0; i < keyvalpair; ++i) {
-        std::string key = decodeString(content, currentPos);
-        if (key == "_name") {
-            transform.name = decodeString(content, currentPos);
-        } else {
-            std::string hidden = decodeString(content, currentPos);
+    // DICT: get keyval pair, values are all strings
+    VoxTransform::Frame* frames = arena.allocate<VoxTransform::Frame>(numFrames);
+    for (int f = 0; f < numFrames; ++f) {
+        VoxTransform::Frame& frame = *new (&frames[f]) VoxTransform::Frame();
+        frame.index = f;
+        int keyvalpair;
+        if (!decodeCount(content, size, currentPos, DictEntrySize, keyvalpair))
+            return false;
+        for (int i = 0; i < keyvalpair; ++i) {
+            VoxString key;
+            VoxString value;
+            if (!decodeString(content, size, currentPos, key) || !decodeString(content, size, currentPos, value))
+                return false;
+            if (key == "_r") {
+                int rotation;
+                parseInts(value, &rotation, 1);
+                decodeRotation(rotation, &frame.rotation[0]);
+            } else if (key == "_t") {
+                parseInts(value, frame.translation, 3);
+            } else if (key == "_f") {
+                parseInts(value, &frame.index, 1);
+            }
         }
     }
 
-    transform.childNodeId = decodeInt(content, currentPos);
-    transform.reservedId = decodeInt(content, currentPos);
-    transform.layerId = decodeInt(content, currentPos);
-    transform.numFrames = decodeInt(content, currentPos);
-
-    // DICT: get keyval pair
-    keyvalpair = decodeInt(content, currentPos);
-    for (int i = 0; i < keyvalpair; ++i) {
-        std::string key = decodeString(content, currentPos);
-        if (key == "_r") {
-            decodeRotation(content[currentPos], &transform.initialFrame.rotation[0]);
-            currentPos++;
-        } else {
-            std::string translationString = decodeString(content, currentPos);
-            TransformTranslate values = convertStringToVec3(translationString);
-            transform.initialFrame.translation[0] = values[0];
-            transform.initialFrame.translation[1] = values[1];
-            transform.initialFrame.translation[2] = values[2];
-        }
-    }
+    std::stable_sort(frames, frames + numFrames,
+                     [](const VoxTransform::Frame& a, const VoxTransform::Frame& b) { return a.index < b.index; });
+    transform.numFrames = numFrames;
+    transform.frames = frames;
+    if (numFrames > 0)
+        transform.initialFrame = frames[0];
 
 #ifdef DEBUG
     print(transform);
 #endif
-    _voxScene.transforms.push_back(transform);
+    return true;
 }
 /*=================================
 (2) Group Node Chunk : "nGRP"
@@ -354,35 +625,25 @@ int32   : num of children nodes
 int32   : child node id
 }xN*/
 
-void VoxReader::decodeGroup(const uint8_t* content)
+bool VoxReader::decodeGroup(const uint8_t* content, uint32_t size, VoxGroup& group, Arena& arena)
 {
-    VoxGroup group;
-    int currentPos = 0;
-    group.nodeId = decodeInt(content, currentPos);
-
-    int keyvalpair = decodeInt(content, currentPos);
-    for (int i = 0; i < keyvalpair; ++i) {
-        std::string key = decodeString(content, currentPos);
-        if (key == "_name") {
-            group.name = decodeString(content, currentPos);
-        } else {
-            std::string hidden = decodeString(content, currentPos);
-        }
-    }
-
-    group.numChildren = decodeInt(content, currentPos);
-
-    std::vector<int> children;
-    children.reserve(group.numChildren);
-    for (int i = 0; i < group.numChildren; ++i) {
-        children.push_back(decodeInt(content, currentPos));
-    }
+    uint32_t currentPos = 0;
+    int numChildren;
+    if (!decodeInt(content, size, currentPos, group.nodeId) ||
+        !decodeNodeAttributes(content, size, currentPos, group.name, group.hidden) ||
+        !decodeCount(content, size, currentPos, 4, numChildren))
+        return false;
 
+    int* children = arena.allocate<int>(numChildren);
+    // the count was checked to fit in the chunk
+    for (int i = 0; i < numChildren; ++i)
+        decodeInt(content, size, currentPos, children[i]);
+    group.numChildren = numChildren;
     group.children = children;
-    _voxScene.groups.push_back(group);
 #ifdef DEBUG
     print(group);
 #endif
+    return true;
 }
 
 /*=================================
@@ -390,90 +651,154 @@ void VoxReader::decodeGroup(const uint8_t* content)
 
 int32   : node id
 DICT    : node attributes
-int32   : num of models (must be 1)
+int32   : num of models
 
 // for each model
 {
 int32   : model id
-DICT    : model attributes : reserved
+DICT    : model attributes
+      (_f : int32) animation frame, the index of the model when missing
 }xN*/
 
-void VoxReader::decodeShape(const uint8_t* content)
+bool VoxReader::decodeShape(const uint8_t* content, uint32_t size, VoxShape& shape, Arena& arena)
 {
-    VoxShape shape;
-    int currentPos = 0;
-    shape.nodeId = decodeInt(content, currentPos);
-
-    int keyvalpair = decodeInt(content, currentPos);
-    for (int i = 0; i < keyvalpair; ++i) {
-        std::string key = decodeString(content, currentPos);
-        if (key == "_name") {
-            shape.name = decodeString(content, currentPos);
-        } else {
-            std::string hidden = decodeString(content, currentPos);
-        }
-    }
+    uint32_t currentPos = 0;
+    int numModels;
+    if (!decodeInt(content, size, currentPos, shape.nodeId) ||
+        !decodeNodeAttributes(content, size, currentPos, shape.name, shape.hidden) ||
+        !decodeCount(content, size, currentPos, 8, numModels))
+        return false;
 
-    shape.numModels = decodeInt(content, currentPos);
-    std::map<int, std::pair<std::string, std::string>> models;
-    for (int i = 0; i < shape.numModels; ++i) {
-        int modelId = decodeInt(content, currentPos);
-        int subKeyvalpair = decodeInt(content, currentPos);
-        std::string name, hidden;
+    VoxShape::Model* models = arena.allocate<VoxShape::Model>(numModels);
+    for (int i = 0; i < numModels; ++i) {
+        models[i].frame = i;
+        int subKeyvalpair;
+        if (!decodeInt(content, size, currentPos, models[i].modelId) ||
+            !decodeCount(content, size, currentPos, DictEntrySize, subKeyvalpair))
+            return false;
         for (int j = 0; j < subKeyvalpair; ++j) {
-            std::string key = decodeString(content, currentPos);
-            if (key == "_name") {
-                name = decodeString(content, currentPos);
-            } else {
-                hidden = decodeString(content, currentPos);
-            }
+            VoxString key;
+            VoxString value;
+            if (!decodeString(content, size, currentPos, key) || !decodeString(content, size, currentPos, value))
+                return false;
+            if (key == "_f")
+                parseInts(value, &models[i].frame, 1);
         }
-
-        models.insert(std::pair<int, std::pair<std::string, std::string>>(
-            modelId, std::pair<std::string, std::string>(name, hidden)));
     }
 
+    std::stable_sort(models, models + numModels,
+                     [](const VoxShape::Model& a, const VoxShape::Model& b) { return a.frame < b.frame; });
+    shape.numModels = numModels;
     shape.models = models;
-
-    _voxScene.shapes.push_back(shape);
 #ifdef DEBUG
     print(shape);
 #endif
+    return true;
 }
 
-bool VoxReader::decodePosChunk(const uint8_t* content)
+bool VoxReader::decodePosChunk(const uint8_t* content, unsigned int size, VoxModel& voxels) const
 {
     uint32_t nbVoxels;
+    if (size < 4)
+        return false;
     memcpy(&nbVoxels, content, sizeof(uint32_t));
-    VoxModel voxels(nbVoxels);
-    memcpy(&voxels[0], content + 4, 4 * nbVoxels);
-    printf("%lu voxels\n", voxels.size());
-    _voxScene.voxels.push_back(voxels);
+    if (nbVoxels > (size - 4) / 4)
+        return false;
+
+    voxels.resize(nbVoxels);
+    if (nbVoxels)
+        memcpy(&voxels[0], content + 4, 4 * nbVoxels);
     return true;
 }
 
-bool VoxReader::decodePaletteChunk(const uint8_t* content, unsigned int size)
+bool VoxReader::decodePaletteChunk(const uint8_t* content, unsigned int size, VoxPalette& palette)
 {
-    VoxPalette palette;
-    palette.reserve(size + 1);
-    palette.push_back(0);
-    memcpy(&palette[1], content, size * 4);
-    _voxScene.palettes.push_back(palette);
+    // color index 0 is empty, the chunk holds the 256 colors from index 1
+    palette.assign(257, 0);
+    memcpy(&palette[1], content, std::min(size, 256u * 4));
     return true;
 }
 
-bool VoxReader::decodeMaterialChunk(const uint8_t* content)
+bool VoxReader::decodeMaterialChunk(const uint8_t* content, uint32_t size, int& materialId, VoxMaterial& material)
 {
-    VoxMaterial material;
-    int currentPos = 0;
-    int materialId = decodeInt(content, currentPos);
-    int nbKeys = decodeInt(content, currentPos);
+    uint32_t currentPos = 0;
+    int nbKeys;
+    if (!decodeInt(content, size, currentPos, materialId) ||
+        !decodeCount(content, size, currentPos, DictEntrySize, nbKeys))
+        return false;
     for (int i = 0; i < nbKeys; ++i) {
-        std::string key = decodeString(content, currentPos);
-        std::string value = decodeString(content, currentPos);
+        VoxString key;
+        VoxString value;
+        if (!decodeString(content, size, currentPos, key) || !decodeString(content, size, currentPos, value))
+            return false;
         material.setFromProperty(key, value);
     }
-
-    _voxScene.materials[materialId] = material;
     return true;
 }
+
+// Frames and models are sorted, the one shown is the last starting at or
+// before frame, the first one before them all
+const VoxShape::Model* VoxShape::modelAt(int frame) const
+{
+    if (numModels <= 0)
+        return nullptr;
+    const Model* model = models;
+    for (int i = 1; i < numModels && models[i].frame <= frame; i++)
+        model = &models[i];
+    return model;
+}
+
+const VoxTransform::Frame& VoxTransform::frameAt(int frame) const
+{
+    const Frame* found = &initialFrame;
+    for (int i = 1; i < numFrames && frames[i].index <= frame; i++)
+        found = &frames[i];
+    return *found;
+}
+
+// keys are told apart by their second character
+void VoxMaterial::setFromProperty(const VoxString& key, const VoxString& value)
+{
+    if (key.size < 2)
+        return;
+
+    float* property = nullptr;
+    switch (key.data[1]) {
+    case 't':
+        if (key == "_type") {
+            if (value == "_diffuse") {
+                type = DIFFUSE;
+            } else if (value == "_metal") {
+                type = METAL;
+            } else if (value == "_glass") {
+                type = GLASS;
+            } else if (value == "_emit") {
+                type = EMIT;
+            }
+        }
+        return;
+    case 'w':
+        property = key == "_weight" ? &weight : nullptr;
+        break;
+    case 'r':
+        property = key == "_rough" ? &rough : nullptr;
+        break;
+    case 's':
+        property = key == "_spec" ? &spec : nullptr;
+        break;
+    case 'i':
+        property = key == "_ior" ? &ior : nullptr;
+        break;
+    case 'a':
+        property = key == "_att" ? &att : nullptr;
+        break;
+    case 'f':
+        property = key == "_flux" ? &flux : nullptr;
+        break;
+    case 'p':
+        property = key == "_plastic" ? &plastic : nullptr;
+        break;
+    }
+    if (property)
+        *property = parseFloat(value);
+}
@@ -1,7 +1,12 @@
 #pragma once
 
+#include "Arena.h"
+#include "MappedFile.h"
+
 #include <bitset>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <map>
 #include <string>
 #include <vector>
@@ -18,36 +23,65 @@ struct VoxelPos {
 typedef std::vector<VoxelPos> VoxModel;
 typedef std::vector<int> VoxPalette;
 
+// String of the vox data, not terminated. Decoded strings are checked to lie
+// within their chunk.
+struct VoxString {
+    const char* data = nullptr;
+    uint32_t size = 0;
+
+    bool empty() const { return size == 0; }
+    std::string str() const { return std::string(data, size); }
+    bool operator==(const char* text) const { return strlen(text) == size && memcmp(data, text, size) == 0; }
+};
+
+// Nodes are plain data. Those of a reader have their strings in the vox data
+// and their arrays in the arena of the reader, those of a VoxScene both in the
+// arena of the scene. A node left malformed has no arrays and empty strings or
+// strings within its chunk.
 struct VoxGroup {
     int nodeId;
-    std::string name;
-    bool hidden;
-    int numChildren;
-    std::vector<int> children;
+    VoxString name;
+    bool hidden = false;
+    int numChildren = 0;
+    const int* children = nullptr;
 };
 
+// Animated nodes change at animation frames given by _f, each model or
+// transform frame holds until the next one
 struct VoxShape {
+    struct Model {
+        int modelId;
+        int frame; // first animation frame showing the model
+    };
+
     int nodeId;
-    std::string name;
-    bool hidden;
-    int numModels;
-    std::map<int, std::pair<std::string, std::string>> models;
+    VoxString name;
+    bool hidden = false;
+    int numModels = 0;
+    const Model* models = nullptr; // sorted by frame
+
+    // model shown at an animation frame, null without models
+    const Model* modelAt(int frame) const;
 };
 
 struct VoxTransform {
     struct Frame {
+        int index = 0; // first animation frame of the transform
         float rotation[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
         int translation[3] = {0, 0, 0};
     };
 
     int nodeId;
-    std::string name;
-    bool hidden;
+    VoxString name;
+    bool hidden = false;
     int childNodeId;
     int reservedId;
     int layerId;
-    int numFrames;
-    Frame initialFrame;
+    int numFrames = 0;
+    Frame initialFrame;            // first of frames, identity without frames
+    const Frame* frames = nullptr; // sorted by index
+
+    const Frame& frameAt(int frame) const;
 };
 
 struct VoxMaterial {
@@ -62,36 +96,7 @@ struct VoxMaterial {
     float flux = -1.0;
     float plastic = -1.0;
 
-    void setFromProperty(const std::string& key, const std::string& value)
-    {
-        if (key == "_type") {
-            if (value == "_diffuse") {
-                type = DIFFUSE;
-            } else if (value == "_metal") {
-                type = METAL;
-            } else if (value == "_glass") {
-                type = GLASS;
-            } else if (value == "_emit") {
-                type = EMIT;
-            }
-        }
-
-        if (key == "_weight") {
-            weight = stof(value);
-        } else if (key == "_rough") {
-            rough = stof(value);
-        } else if (key == "_spec") {
-            spec = stof(value);
-        } else if (key == "_ior") {
-            ior = stof(value);
-        } else if (key == "_att") {
-            att = stof(value);
-        } else if (key == "_flux") {
-            flux = stof(value);
-        } else if (key == "_plastic") {
-            plastic = stof(value);
-        }
-    }
+    void setFromProperty(const VoxString& key, const VoxString& value);
 
     bool operator==(const VoxMaterial& other)
     {
@@ -111,6 +116,21 @@ struct VoxScene {
     std::vector<VoxGroup> groups;
     std::vector<VoxTransform> transforms;
     std::vector<VoxShape> shapes;
+    // strings and arrays of the nodes, freed with the scene
+    Arena arena;
+};
+
+// Content of a chunk in the vox data
+struct VoxChunk {
+    uint32_t id;     // four character code as stored in the file
+    uint32_t offset; // of the content from the start of the data
+    uint32_t size;   // of the content
+};
+
+struct VoxModelInfo {
+    uint32_t sizeX, sizeY, sizeZ;
+    uint32_t numVoxels;
+    int chunk; // index of the XYZI chunk
 };
 
 class VoxReader {
@@ -119,25 +139,84 @@ class VoxReader {
     VoxReader() {}
     ~VoxReader() {}
 
+    // readFile and loadVoxelsData decode the whole scene up front, and fail
+    // on a malformed chunk
     bool readFile(const std::string& filename);
-    VoxScene getVoxelScene() { return _voxScene; }
-
-    bool decodeChunk(const std::string& chunkName, const uint8_t* content, unsigned int size);
-    void readChunk(const uint8_t* bytes, unsigned int size);
-    bool decodeSizeChunk(const uint8_t* content);
-
     bool loadVoxelsData(const uint8_t* bytes, size_t size);
-    uint32_t decodeInt(const uint8_t* content, int& currentPos);
-    std::string decodeString(const uint8_t* content, int& currentPos);
-    void decodeTransform(const uint8_t* content);
-    void decodeGroup(const uint8_t* content);
-    void decodeShape(const uint8_t* content);
-    bool decodePosChunk(const uint8_t* content);
-    bool decodePaletteChunk(const uint8_t* content, unsigned int size);
+    const VoxScene& getVoxelScene() const { return _voxScene; }
+    // Moves the decoded scene out, the reader decodes again what is accessed
+    // next. The scene does not reference the data of the reader.
+    void takeVoxelScene(VoxScene& scene);
+
+    // openFile and indexVoxelsData only index the chunks, models, palette,
+    // materials and nodes are then decoded on first access. Data given to
+    // indexVoxelsData must outlive the reader.
+    bool openFile(const std::string& filename);
+    bool indexVoxelsData(const uint8_t* bytes, size_t size);
+    bool decodeAll();
+
+    const std::vector<VoxChunk>& getChunks() const { return _chunks; }
+    // raw bytes of a chunk as stored in the file
+    const uint8_t* getChunkContent(const VoxChunk& chunk) const { return chunkContent(chunk); }
+    int getNumModels() const { return _models.size(); }
+    const VoxModelInfo& getModelInfo(int index) const { return _models[index]; }
+    int getNumNodes() const { return _nodes.size(); }
+    const VoxModel& getModel(int index);
+    // decodes a model without keeping it in the reader
+    bool readModel(int index, VoxModel& voxels) const;
+    const VoxPalette* getPalette();
+    const std::map<int, VoxMaterial>& getMaterials();
+    const VoxTransform* getTransform(int nodeId);
+    const VoxGroup* getGroup(int nodeId);
+    const VoxShape* getShape(int nodeId);
+    // true once a chunk decoded on access was malformed, node accessors then
+    // return null, getModel an empty model and getMaterials leaves the
+    // material out
+    bool failed() const { return _failed; }
+
+    bool readChunks(const uint8_t* bytes, size_t size);
+    bool decodeSizeChunk(const uint8_t* content, unsigned int size, uint32_t* dimensions);
+
+    // decoders of the content of a chunk of size bytes, false when it is
+    // malformed, arrays of the node are allocated in arena
+    bool decodeInt(const uint8_t* content, uint32_t size, uint32_t& currentPos, int& value);
+    bool decodeString(const uint8_t* content, uint32_t size, uint32_t& currentPos, VoxString& string);
+    bool decodeCount(const uint8_t* content, uint32_t size, uint32_t& currentPos, uint32_t entrySize, int& count);
+    bool decodeNodeAttributes(const uint8_t* content, uint32_t size, uint32_t& currentPos, VoxString& name,
+                              bool& hidden);
+    bool decodeTransform(const uint8_t* content, uint32_t size, VoxTransform& transform, Arena& arena);
+    bool decodeGroup(const uint8_t* content, uint32_t size, VoxGroup& group, Arena& arena);
+    bool decodeShape(const uint8_t* content, uint32_t size, VoxShape& shape, Arena& arena);
+    bool decodePosChunk(const uint8_t* content, unsigned int size, VoxModel& voxels) const;
+    bool decodePaletteChunk(const uint8_t* content, unsigned int size, VoxPalette& palette);
     bool isFloatProp(const std::string& property);
     bool isStringProp(const std::string& property);
-    bool decodeMaterialChunk(const uint8_t* content);
+    bool decodeMaterialChunk(const uint8_t* content, uint32_t size, int& materialId, VoxMaterial& material);
 
   private:
+    const uint8_t* chunkContent(const VoxChunk& chunk) const { return _data + chunk.offset; }
+    // node chunk of a node id, the node decoded in _arena on first access
+    struct Node {
+        int nodeId;
+        int chunk;
+        void* decoded;
+        bool malformed;
+    };
+
+    Node* findNode(int nodeId, uint32_t chunkId);
+    void malformedNode(Node& node);
+
+    MappedFile _file;
+    const uint8_t* _data = nullptr;
+    std::vector<VoxChunk> _chunks;
+    std::vector<VoxModelInfo> _models;
+    std::vector<bool> _modelLoaded;
+    // sorted by node id
+    std::vector<Node> _nodes;
+    int _paletteChunk = -1;
+    bool _materialsLoaded = false;
+    bool _failed = false;
+
+    Arena _arena;
     VoxScene _voxScene;
 };
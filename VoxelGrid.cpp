@@ -0,0 +1,286 @@
+#include "VoxelGrid.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FACE_MASKS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET(name)
+#else
+#define TARGET(name) __attribute__((target(name)))
+#endif
+#endif
+
+void VoxelGrid::build(const VoxModel& voxModel)
+{
+    occupancy.clear();
+    materials.clear();
+    wordsPerRow = 0;
+    if (voxModel.empty())
+        return;
+
+    ucvec3 minPos(255, 255, 255);
+    ucvec3 maxPos(0, 0, 0);
+    for (const VoxelPos& voxelData : voxModel) {
+        for (int axis = 0; axis < 3; axis++) {
+            minPos[axis] = voxelData[axis] < minPos[axis] ? voxelData[axis] : minPos[axis];
+            maxPos[axis] = voxelData[axis] > maxPos[axis] ? voxelData[axis] : maxPos[axis];
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = minPos[axis];
+        size[axis] = maxPos[axis] - minPos[axis] + 1;
+    }
+
+    wordsPerRow = (size[2] + 63) / 64;
+    occupancy.assign((size_t)size[0] * size[1] * wordsPerRow, 0);
+    materials.assign((size_t)size[0] * size[1] * size[2], 0);
+
+    // last voxel wins when a position is listed twice, as with the previous map
+    for (const VoxelPos& voxelData : voxModel) {
+        int x = voxelData[0] - min[0];
+        int y = voxelData[1] - min[1];
+        int z = voxelData[2] - min[2];
+        int rowId = rowIndex(x, y);
+        occupancy[rowId * wordsPerRow + (z >> 6)] |= uint64_t(1) << (z & 63);
+        materials[rowId * size[2] + z] = voxelData[3];
+    }
+}
+
+void allocateFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid)
+{
+    for (int f = 0; f < 6; f++)
+        faceMasks.masks[f].assign(grid.occupancy.size(), 0);
+}
+
+void computeFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid)
+{
+    allocateFaceMasks(faceMasks, grid);
+    if (!grid.empty())
+        computeFaceMasks(faceMasks, grid, 0, grid.size[0]);
+}
+
+// A kernel computes the masks of a plane of the grid, the rows of one x. The
+// plane is seen as count words, row after row. keepPrev and keepNext are all
+// ones except at the first and last word of a row where the z carry from the
+// word of the neighbouring row has to be dropped. nextX and prevX are the
+// neighbouring planes, or a plane of zeros on the grid boundary.
+struct FaceMaskPlane {
+    uint64_t* masks[6];
+    const uint64_t* plane;
+    const uint64_t* nextX;
+    const uint64_t* prevX;
+    const uint64_t* keepPrev;
+    const uint64_t* keepNext;
+    int count;
+    int words;
+};
+
+// Word i of the plane, checking the bounds of the plane along y and z
+static inline void faceMaskWord(const FaceMaskPlane& p, int i)
+{
+    uint64_t bits = p.plane[i];
+    uint64_t nextY = i + p.words < p.count ? p.plane[i + p.words] : 0;
+    uint64_t prevY = i >= p.words ? p.plane[i - p.words] : 0;
+    uint64_t nextZ = (bits >> 1) | (i + 1 < p.count ? (p.plane[i + 1] << 63) & p.keepNext[i] : 0);
+    uint64_t prevZ = (bits << 1) | (i > 0 ? (p.plane[i - 1] >> 63) & p.keepPrev[i] : 0);
+
+    p.masks[0][i] = bits & ~p.nextX[i];
+    p.masks[1][i] = bits & ~nextY;
+    p.masks[2][i] = bits & ~nextZ;
+    p.masks[3][i] = bits & ~p.prevX[i];
+    p.masks[4][i] = bits & ~prevY;
+    p.masks[5][i] = bits & ~prevZ;
+}
+
+// Words [begin, end) away from the first and last row, no bound to check
+static inline void faceMaskWords(const FaceMaskPlane& p, int begin, int end)
+{
+    const uint64_t* plane = p.plane;
+    for (int i = begin; i < end; i++) {
+        uint64_t bits = plane[i];
+        uint64_t nextZ = (bits >> 1) | ((plane[i + 1] << 63) & p.keepNext[i]);
+        uint64_t prevZ = (bits << 1) | ((plane[i - 1] >> 63) & p.keepPrev[i]);
+
+        p.masks[0][i] = bits & ~p.nextX[i];
+        p.masks[1][i] = bits & ~plane[i + p.words];
+        p.masks[2][i] = bits & ~nextZ;
+        p.masks[3][i] = bits & ~p.prevX[i];
+        p.masks[4][i] = bits & ~plane[i - p.words];
+        p.masks[5][i] = bits & ~prevZ;
+    }
+}
+
+// The first and last rows are done word by word, the interior by the kernel
+template <typename Interior>
+static inline void faceMaskPlane(const FaceMaskPlane& p, Interior interior)
+{
+    int begin = std::min(p.words, p.count);
+    int end = std::max(p.count - p.words, begin);
+    for (int i = 0; i < begin; i++)
+        faceMaskWord(p, i);
+    interior(p, begin, end);
+    for (int i = end; i < p.count; i++)
+        faceMaskWord(p, i);
+}
+
+static void faceMasksScalar(const FaceMaskPlane& p) { faceMaskPlane(p, faceMaskWords); }
+
+#ifdef FACE_MASKS_X86
+TARGET("sse2") static void faceMaskWordsSSE2(const FaceMaskPlane& p, int begin, int end)
+{
+    const uint64_t* plane = p.plane;
+    int i = begin;
+    for (; i + 2 <= end; i += 2) {
+        __m128i bits = _mm_loadu_si128((const __m128i*)(plane + i));
+        __m128i next = _mm_loadu_si128((const __m128i*)(plane + i + 1));
+        __m128i prev = _mm_loadu_si128((const __m128i*)(plane + i - 1));
+        __m128i nextZ = _mm_or_si128(_mm_srli_epi64(bits, 1),
+                                     _mm_and_si128(_mm_slli_epi64(next, 63),
+                                                   _mm_loadu_si128((const __m128i*)(p.keepNext + i))));
+        __m128i prevZ = _mm_or_si128(_mm_slli_epi64(bits, 1),
+                                     _mm_and_si128(_mm_srli_epi64(prev, 63),
+                                                   _mm_loadu_si128((const __m128i*)(p.keepPrev + i))));
+
+        // andnot(a, b) is ~a & b
+        _mm_storeu_si128((__m128i*)(p.masks[0] + i),
+                         _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(p.nextX + i)), bits));
+        _mm_storeu_si128((__m128i*)(p.masks[1] + i),
+                         _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(plane + i + p.words)), bits));
+        _mm_storeu_si128((__m128i*)(p.masks[2] + i), _mm_andnot_si128(nextZ, bits));
+        _mm_storeu_si128((__m128i*)(p.masks[3] + i),
+                         _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(p.prevX + i)), bits));
+        _mm_storeu_si128((__m128i*)(p.masks[4] + i),
+                         _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(plane + i - p.words)), bits));
+        _mm_storeu_si128((__m128i*)(p.masks[5] + i), _mm_andnot_si128(prevZ, bits));
+    }
+    faceMaskWords(p, i, end);
+}
+
+TARGET("sse2") static void faceMasksSSE2(const FaceMaskPlane& p) { faceMaskPlane(p, faceMaskWordsSSE2); }
+
+TARGET("avx2") static void faceMaskWordsAVX2(const FaceMaskPlane& p, int begin, int end)
+{
+    const uint64_t* plane = p.plane;
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m256i bits = _mm256_loadu_si256((const __m256i*)(plane + i));
+        __m256i next = _mm256_loadu_si256((const __m256i*)(plane + i + 1));
+        __m256i prev = _mm256_loadu_si256((const __m256i*)(plane + i - 1));
+        __m256i nextZ = _mm256_or_si256(_mm256_srli_epi64(bits, 1),
+                                        _mm256_and_si256(_mm256_slli_epi64(next, 63),
+                                                         _mm256_loadu_si256((const __m256i*)(p.keepNext + i))));
+        __m256i prevZ = _mm256_or_si256(_mm256_slli_epi64(bits, 1),
+                                        _mm256_and_si256(_mm256_srli_epi64(prev, 63),
+                                                         _mm256_loadu_si256((const __m256i*)(p.keepPrev + i))));
+
+        _mm256_storeu_si256((__m256i*)(p.masks[0] + i),
+                            _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*)(p.nextX + i)), bits));
+        _mm256_storeu_si256((__m256i*)(p.masks[1] + i),
+                            _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*)(plane + i + p.words)), bits));
+        _mm256_storeu_si256((__m256i*)(p.masks[2] + i), _mm256_andnot_si256(nextZ, bits));
+        _mm256_storeu_si256((__m256i*)(p.masks[3] + i),
+                            _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*)(p.prevX + i)), bits));
+        _mm256_storeu_si256((__m256i*)(p.masks[4] + i),
+                            _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*)(plane + i - p.words)), bits));
+        _mm256_storeu_si256((__m256i*)(p.masks[5] + i), _mm256_andnot_si256(prevZ, bits));
+    }
+    faceMaskWords(p, i, end);
+}
+
+TARGET("avx2") static void faceMasksAVX2(const FaceMaskPlane& p) { faceMaskPlane(p, faceMaskWordsAVX2); }
+
+static bool cpuSupports(FaceMaskKernel kernel)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] >> 26) & 1;
+    // avx registers have to be saved by the system too
+    bool osAVX = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    bool avx2 = osAVX && ((info[1] >> 5) & 1);
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    return kernel == FACE_MASK_SCALAR || (kernel == FACE_MASK_SSE2 && sse2) || (kernel == FACE_MASK_AVX2 && avx2);
+}
+#else
+static bool cpuSupports(FaceMaskKernel kernel) { return kernel == FACE_MASK_SCALAR; }
+#endif
+
+static const char* KernelNames[NUM_FACE_MASK_KERNELS] = {"scalar", "sse2", "avx2"};
+
+const char* faceMaskKernelName(FaceMaskKernel kernel) { return KernelNames[kernel]; }
+
+bool faceMaskKernelSupported(FaceMaskKernel kernel) { return cpuSupports(kernel); }
+
+static FaceMaskKernel selectKernel()
+{
+    int kernel = NUM_FACE_MASK_KERNELS - 1;
+    while (kernel > FACE_MASK_SCALAR && !cpuSupports((FaceMaskKernel)kernel))
+        kernel--;
+
+    // the variable can only lower the choice, for testing the other kernels
+    const char* forced = getenv("VOX2MESH_SIMD");
+    for (int i = 0; forced && i < kernel; i++) {
+        if (strcmp(forced, KernelNames[i]) == 0)
+            kernel = i;
+    }
+    return (FaceMaskKernel)kernel;
+}
+
+FaceMaskKernel selectedFaceMaskKernel()
+{
+    static const FaceMaskKernel kernel = selectKernel();
+    return kernel;
+}
+
+void computeFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid, int xBegin, int xEnd)
+{
+    computeFaceMasks(faceMasks, grid, xBegin, xEnd, selectedFaceMaskKernel());
+}
+
+void computeFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid, int xBegin, int xEnd, FaceMaskKernel kernel)
+{
+    if (!cpuSupports(kernel))
+        kernel = FACE_MASK_SCALAR;
+    void (*computePlane)(const FaceMaskPlane&) = faceMasksScalar;
+#ifdef FACE_MASKS_X86
+    if (kernel == FACE_MASK_SSE2)
+        computePlane = faceMasksSSE2;
+    else if (kernel == FACE_MASK_AVX2)
+        computePlane = faceMasksAVX2;
+#endif
+
+    const int words = grid.wordsPerRow;
+    const int count = grid.size[1] * words;
+    std::vector<uint64_t> zeros(count, 0);
+    std::vector<uint64_t> keepPrev(count, ~uint64_t(0));
+    std::vector<uint64_t> keepNext(count, ~uint64_t(0));
+    for (int i = 0; i < count; i += words) {
+        keepPrev[i] = 0;
+        keepNext[i + words - 1] = 0;
+    }
+
+    FaceMaskPlane p;
+    p.keepPrev = keepPrev.data();
+    p.keepNext = keepNext.data();
+    p.count = count;
+    p.words = words;
+    for (int x = xBegin; x < xEnd; x++) {
+        size_t base = (size_t)grid.rowIndex(x, 0) * words;
+        for (int f = 0; f < 6; f++)
+            p.masks[f] = &faceMasks.masks[f][base];
+        p.plane = grid.row(x, 0);
+        p.nextX = x + 1 < grid.size[0] ? grid.row(x + 1, 0) : zeros.data();
+        p.prevX = x > 0 ? grid.row(x - 1, 0) : zeros.data();
+        computePlane(p);
+    }
+}
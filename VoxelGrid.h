@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "VoxReader.h"
+#include "polygonize.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline int countTrailingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+inline int countBits(uint64_t value)
+{
+#ifdef _MSC_VER
+    return (int)__popcnt64(value);
+#else
+    return __builtin_popcountll(value);
+#endif
+}
+
+// Dense occupancy of a model over its bounding box. Solidity is one bit per
+// cell packed in rows of 64 bits words running along z, a row per (x, y).
+// Materials are one byte per cell with the same (x, y, z) ordering.
+// Coordinates passed to the accessors are relative to min.
+struct VoxelGrid {
+    ivec3 min;
+    ivec3 size;
+    int wordsPerRow = 0;
+    std::vector<uint64_t> occupancy;
+    std::vector<MaterialID> materials;
+
+    void build(const VoxModel& voxModel);
+
+    inline bool empty() const { return occupancy.empty(); }
+    inline int rowIndex(int x, int y) const { return x * size[1] + y; }
+    inline const uint64_t* row(int x, int y) const { return &occupancy[rowIndex(x, y) * wordsPerRow]; }
+    inline bool isSolid(int x, int y, int z) const { return (row(x, y)[z >> 6] >> (z & 63)) & 1; }
+    inline MaterialID material(int x, int y, int z) const { return materials[rowIndex(x, y) * size[2] + z]; }
+};
+
+// Exposed faces of a VoxelGrid, one bit array per direction using the layout of
+// VoxelGrid::occupancy. Direction index follows NormalFace: +x +y +z -x -y -z.
+struct VoxelFaceMasks {
+    std::vector<uint64_t> masks[6];
+};
+
+void computeFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid);
+
+// Slab version for parallel use, faceMasks must be allocated to the grid size.
+// Only rows with x in [xBegin, xEnd) are written.
+void allocateFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid);
+void computeFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid, int xBegin, int xEnd);
+
+// Implementations of computeFaceMasks, they give the same bits. The best one
+// the cpu supports is used, VOX2MESH_SIMD=scalar|sse2 selects a lower one.
+enum FaceMaskKernel { FACE_MASK_SCALAR, FACE_MASK_SSE2, FACE_MASK_AVX2, NUM_FACE_MASK_KERNELS };
+
+FaceMaskKernel selectedFaceMaskKernel();
+bool faceMaskKernelSupported(FaceMaskKernel kernel);
+const char* faceMaskKernelName(FaceMaskKernel kernel);
+// computes with the given kernel, the scalar one when the cpu lacks it
+void computeFaceMasks(VoxelFaceMasks& faceMasks, const VoxelGrid& grid, int xBegin, int xEnd, FaceMaskKernel kernel);
@@ -0,0 +1,178 @@
+#include "World.h"
+#include "ChunkCoord.h"
+#include "Log.h"
+#include "MeshWriter.h"
+#include "SceneGraph.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "VoxReader.h"
+#include "VoxelGrid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+// Voxels of a chunk in chunk coordinates, [0, WorldChunkSize) on each axis
+struct WorldChunk {
+    ivec3 coord;
+    VoxModel voxels;
+
+    bool operator<(const WorldChunk& other) const { return lessCoord(coord, other.coord); }
+};
+
+static bool placeInstances(std::vector<WorldChunk>& chunks, const VoxReader& reader,
+                           const std::vector<VoxInstance>& instances, ThreadPool* threadPool)
+{
+    std::vector<int> models;
+    std::vector<bool> used(reader.getNumModels(), false);
+    for (const VoxInstance& instance : instances) {
+        if (!used[instance.model])
+            models.push_back(instance.model);
+        used[instance.model] = true;
+    }
+
+    std::vector<VoxModel> voxels(reader.getNumModels());
+    std::atomic<bool> failed(false);
+    parallelFor(threadPool, models.size(), [&](int i) {
+        if (!reader.readModel(models[i], voxels[models[i]])) {
+            logMessage(LOG_ERROR, "error decoding model %d\n", models[i]);
+            failed = true;
+        }
+    });
+
+    // in instance order, so the last instance covering a position wins
+    std::unordered_map<uint64_t, size_t> chunkIndexes;
+    for (const VoxInstance& instance : instances) {
+        const int* rotation = instance.rotation;
+        for (const VoxelPos& voxel : voxels[instance.model]) {
+            ivec3 world;
+            for (int row = 0; row < 3; row++)
+                world[row] = rotation[row * 3] * voxel[0] + rotation[row * 3 + 1] * voxel[1] +
+                             rotation[row * 3 + 2] * voxel[2] + instance.translation[row];
+
+            ivec3 coord;
+            VoxelPos local;
+            for (int axis = 0; axis < 3; axis++) {
+                coord[axis] = floorDiv(world[axis], WorldChunkSize);
+                local[axis] = (uint8_t)(world[axis] - coord[axis] * WorldChunkSize);
+            }
+            local[3] = voxel[3];
+
+            std::pair<std::unordered_map<uint64_t, size_t>::iterator, bool> inserted =
+                chunkIndexes.insert(std::make_pair(chunkKey(coord), chunks.size()));
+            if (inserted.second) {
+                chunks.push_back(WorldChunk());
+                chunks.back().coord = coord;
+            }
+            chunks[inserted.first->second].voxels.push_back(local);
+        }
+    }
+
+    std::sort(chunks.begin(), chunks.end());
+    return !failed;
+}
+
+// Meshes a chunk with a one voxel apron taken from its neighbours, the apron
+// hides faces on the chunk boundary and darkens corners without being meshed.
+// Only the 6 face neighbours hide faces, the 20 edge and corner ones are read
+// for occlusion alone.
+static void polygonizeChunk(VoxelGroup& group, const std::vector<WorldChunk>& chunks, size_t index,
+                            const PolygonizeOptions& options)
+{
+    const WorldChunk& chunk = chunks[index];
+    VoxModel voxels;
+    for (VoxelPos voxel : chunk.voxels) {
+        for (int axis = 0; axis < 3; axis++)
+            voxel[axis]++;
+        voxels.push_back(voxel);
+    }
+
+    for (int i = 0; i < 27; i++) {
+        ivec3 step = neighbourStep(i);
+        int numSteps = (step[0] != 0) + (step[1] != 0) + (step[2] != 0);
+        if (!numSteps || (numSteps > 1 && !options.occlusion))
+            continue;
+
+        WorldChunk key;
+        key.coord = chunk.coord + step;
+        std::vector<WorldChunk>::const_iterator neighbour = std::lower_bound(chunks.begin(), chunks.end(), key);
+        if (neighbour == chunks.end() || key < *neighbour)
+            continue;
+
+        // along each stepped axis only the layer of the neighbour touching
+        // this chunk is kept, and goes to the apron on that side
+        for (VoxelPos voxel : neighbour->voxels) {
+            bool touches = true;
+            for (int axis = 0; axis < 3 && touches; axis++) {
+                if (step[axis] > 0) {
+                    touches = voxel[axis] == 0;
+                    voxel[axis] = WorldChunkSize + 1;
+                } else if (step[axis] < 0) {
+                    touches = voxel[axis] == WorldChunkSize - 1;
+                    voxel[axis] = 0;
+                } else {
+                    voxel[axis]++;
+                }
+            }
+            if (touches)
+                voxels.push_back(voxel);
+        }
+    }
+
+    VoxelGrid grid;
+    grid.build(voxels);
+    ivec3 keepMin, keepMax;
+    for (int axis = 0; axis < 3; axis++) {
+        keepMin[axis] = 1 - grid.min[axis];
+        keepMax[axis] = WorldChunkSize + 1 - grid.min[axis];
+    }
+    polygonize(group, grid, keepMin, keepMax, options);
+
+    // meshed at the chunk origin, far chunks move to the float storage
+    // rather than wrap their compact corners
+    ivec3 offset;
+    for (int axis = 0; axis < 3; axis++)
+        offset[axis] = chunk.coord[axis] * WorldChunkSize - 1;
+    for (VoxelGroup::iterator it = group.begin(); it != group.end(); it++)
+        it->second.translate(offset);
+}
+
+bool convertWorld(VoxReader& reader, MeshWriter& writer, const PolygonizeOptions& options)
+{
+    std::vector<WorldChunk> chunks;
+    bool converted;
+    {
+        StageTimer timer(options.stats, STAGE_PARSE);
+        std::vector<VoxInstance> instances;
+        converted = flattenScene(instances, reader) && placeInstances(chunks, reader, instances, options.threadPool);
+    }
+
+    // chunks are meshed by windows and written in order, the memory held is
+    // the one of a window
+    ThreadPool* threadPool = options.threadPool;
+    size_t windowSize = threadPool ? threadPool->size() * 2 : 1;
+    std::vector<VoxelGroup> meshes(windowSize);
+    for (size_t first = 0; first < chunks.size(); first += windowSize) {
+        size_t count = std::min(windowSize, chunks.size() - first);
+        {
+            StageTimer timer(options.stats, STAGE_MESH);
+            parallelFor(threadPool, count, [&](int i) {
+                meshes[i].clear();
+                polygonizeChunk(meshes[i], chunks, first + i, options);
+            });
+        }
+
+        StageTimer timer(options.stats, STAGE_WRITE);
+        for (size_t i = 0; i < count; i++) {
+            const WorldChunk& chunk = chunks[first + i];
+            if (options.stats)
+                options.stats->addMesh((int)(first + i), chunk.voxels.size(), meshes[i], false);
+            if (meshes[i].empty())
+                continue;
+            char name[64];
+            snprintf(name, sizeof(name), "chunk_%d_%d_%d", chunk.coord[0], chunk.coord[1], chunk.coord[2]);
+            converted = writer.write(meshes[i], name) && converted;
+        }
+    }
+    return converted;
+}
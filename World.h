@@ -0,0 +1,17 @@
+#pragma once
+
+#include "polygonize.h"
+
+class MeshWriter;
+class VoxReader;
+
+// Edge of the cubic chunks the world is meshed in, in voxels
+static const int WorldChunkSize = 64;
+
+// Places every instance of the scene in a sparse world grid, voxels of later
+// instances replacing the ones of earlier instances, and meshes it chunk by
+// chunk. Faces between neighbouring models are culled like faces inside a
+// model. Each chunk with faces is written as a mesh named chunk_X_Y_Z, chunks
+// are meshed in parallel when options has a thread pool. Returns false when the
+// file has a malformed chunk, a model failed to decode or a write failed.
+bool convertWorld(VoxReader& reader, MeshWriter& writer, const PolygonizeOptions& options);
@@ -0,0 +1,788 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <getopt.h>
+#include <math.h>
+#include <memory>
+#include <new>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ChunkedMesh.h"
+#include "Convert.h"
+#include "Log.h"
+#include "MeshWriter.h"
+#include "ThreadPool.h"
+#include "Triangles.h"
+#include "VoxReader.h"
+#include "VoxelGrid.h"
+#include "polygonize.h"
+
+// Every allocation of the process goes through these, stages report the
+// difference of the counters around them
+static std::atomic<uint64_t> allocationCount(0);
+static std::atomic<uint64_t> allocationBytes(0);
+
+void* operator new(size_t size)
+{
+    allocationCount++;
+    allocationBytes += size;
+    void* pointer = malloc(size ? size : 1);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+// out of line so the compiler does not pair the free with a new expression
+__attribute__((noinline)) static void release(void* pointer) { free(pointer); }
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* pointer) noexcept { release(pointer); }
+void operator delete[](void* pointer) noexcept { release(pointer); }
+
+void printUsage()
+{
+    const char* text = "vox2mesh_bench times each stage of the conversion on generated models\n"
+                       "usage:\n"
+                       " vox2mesh_bench [options]\n"
+                       "options:\n"
+                       " -s, --size N     edge of the large models, 256 by default\n"
+                       " -r, --repeat N   runs per stage, the fastest is kept, 3 by default\n"
+                       " -j, --jobs N     mesh and write with N threads\n"
+                       " -c, --case NAME  only run the cases whose name contains NAME\n"
+                       " -o, --output F   JSON results file, vox2mesh_bench.json by default\n"
+                       " -h, --help       print this help\n"
+                       "\n";
+
+    printf("%s", text);
+}
+
+struct Options {
+    int size = 256;
+    int repeat = 3;
+    int jobs = 1;
+    const char* filter = "";
+    const char* outputFile = "vox2mesh_bench.json";
+};
+
+struct BenchCase {
+    std::string name;
+    std::vector<VoxModel> models;
+    std::vector<ivec3> sizes;
+    // place the models with scene graph nodes in the vox data
+    bool scene = false;
+};
+
+static inline void addVoxel(VoxModel& model, int x, int y, int z, int material)
+{
+    VoxelPos voxel;
+    voxel[0] = x;
+    voxel[1] = y;
+    voxel[2] = z;
+    voxel[3] = material;
+    model.push_back(voxel);
+}
+
+static inline uint32_t hashLattice(int x, int y, int z, uint32_t seed)
+{
+    uint32_t hash = seed + x * 374761393u + y * 668265263u + z * 2246822519u;
+    hash = (hash ^ (hash >> 13)) * 1274126177u;
+    return hash ^ (hash >> 16);
+}
+
+static inline float smooth(float t) { return t * t * (3.0f - 2.0f * t); }
+
+// value noise in [0, 1] interpolated between random values on an integer lattice
+static float valueNoise(float x, float y, float z, uint32_t seed)
+{
+    int x0 = (int)floorf(x), y0 = (int)floorf(y), z0 = (int)floorf(z);
+    float tx = smooth(x - x0), ty = smooth(y - y0), tz = smooth(z - z0);
+
+    float corners[8];
+    for (int i = 0; i < 8; i++)
+        corners[i] = hashLattice(x0 + (i & 1), y0 + ((i >> 1) & 1), z0 + (i >> 2), seed) / 4294967295.0f;
+
+    float x00 = corners[0] + (corners[1] - corners[0]) * tx;
+    float x10 = corners[2] + (corners[3] - corners[2]) * tx;
+    float x01 = corners[4] + (corners[5] - corners[4]) * tx;
+    float x11 = corners[6] + (corners[7] - corners[6]) * tx;
+    float y0v = x00 + (x10 - x00) * ty;
+    float y1v = x01 + (x11 - x01) * ty;
+    return y0v + (y1v - y0v) * tz;
+}
+
+static float fractalNoise(float x, float y, float z, uint32_t seed)
+{
+    float value = 0, amplitude = 0.5f;
+    for (int octave = 0; octave < 4; octave++) {
+        value += valueNoise(x, y, z, seed + octave) * amplitude;
+        x *= 2;
+        y *= 2;
+        z *= 2;
+        amplitude *= 0.5f;
+    }
+    return value;
+}
+
+static void addModel(BenchCase& bench, const VoxModel& model, int sizeX, int sizeY, int sizeZ)
+{
+    bench.models.push_back(model);
+    bench.sizes.push_back(ivec3(sizeX, sizeY, sizeZ));
+}
+
+static BenchCase solidCube(int size)
+{
+    BenchCase bench;
+    bench.name = "solid_cube";
+    VoxModel model;
+    model.reserve((size_t)size * size * size);
+    for (int x = 0; x < size; x++)
+        for (int y = 0; y < size; y++)
+            for (int z = 0; z < size; z++)
+                addVoxel(model, x, y, z, 1 + (x * 4 / size));
+    addModel(bench, model, size, size, size);
+    return bench;
+}
+
+static BenchCase hollowSphere(int size)
+{
+    BenchCase bench;
+    bench.name = "hollow_sphere";
+    VoxModel model;
+    float center = (size - 1) * 0.5f;
+    float outer = size * 0.5f;
+    float inner = outer - 2.0f;
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            for (int z = 0; z < size; z++) {
+                float dx = x - center, dy = y - center, dz = z - center;
+                float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+                if (distance < outer && distance >= inner)
+                    addVoxel(model, x, y, z, 1 + (z * 8 / size));
+            }
+        }
+    }
+    addModel(bench, model, size, size, size);
+    return bench;
+}
+
+// 3D noise density biased by the height, giving overhangs and caves
+static VoxModel noiseTerrain(int size, int height, uint32_t seed)
+{
+    VoxModel model;
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            for (int z = 0; z < height; z++) {
+                float density = fractalNoise(x / 32.0f, y / 32.0f, z / 32.0f, seed);
+                if (density > (float)z / height * 0.8f + 0.1f)
+                    addVoxel(model, x, y, z, 1 + (z * 6 / height));
+            }
+        }
+    }
+    return model;
+}
+
+static BenchCase terrain(int size)
+{
+    BenchCase bench;
+    bench.name = "noise_terrain";
+    addModel(bench, noiseTerrain(size, size / 4, 7), size, size, size / 4);
+    return bench;
+}
+
+// no two voxels share a face, every face of every voxel is emitted
+static BenchCase checkerboard(int size)
+{
+    BenchCase bench;
+    bench.name = "checkerboard";
+    VoxModel model;
+    for (int x = 0; x < size; x++)
+        for (int y = 0; y < size; y++)
+            for (int z = 0; z < size; z++)
+                if ((x + y + z) & 1)
+                    addVoxel(model, x, y, z, 1 + ((x + y) & 3));
+    addModel(bench, model, size, size, size);
+    return bench;
+}
+
+static BenchCase multiModel(int size)
+{
+    BenchCase bench;
+    bench.name = "multi_model_scene";
+    bench.scene = true;
+    for (int i = 0; i < 16; i++)
+        addModel(bench, noiseTerrain(size, size / 2, 100 + i), size, size, size / 2);
+    return bench;
+}
+
+static void appendInt(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.insert(out.end(), (const uint8_t*)&value, (const uint8_t*)&value + 4);
+}
+
+static void appendString(std::vector<uint8_t>& out, const std::string& value)
+{
+    appendInt(out, value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+static void appendChunk(std::vector<uint8_t>& out, const char* id, const std::vector<uint8_t>& content,
+                        uint32_t childrenSize = 0)
+{
+    out.insert(out.end(), id, id + 4);
+    appendInt(out, content.size());
+    appendInt(out, childrenSize);
+    out.insert(out.end(), content.begin(), content.end());
+}
+
+static void appendTransform(std::vector<uint8_t>& out, int nodeId, int childId, const std::string& translation)
+{
+    std::vector<uint8_t> content;
+    appendInt(content, nodeId);
+    appendInt(content, 0); // no attribute
+    appendInt(content, childId);
+    appendInt(content, -1);
+    appendInt(content, 0);
+    appendInt(content, 1);
+    appendInt(content, translation.empty() ? 0 : 1);
+    if (!translation.empty()) {
+        appendString(content, "_t");
+        appendString(content, translation);
+    }
+    appendChunk(out, "nTRN", content);
+}
+
+// Models in a grid when the case is a scene, two instances of each
+static std::vector<uint8_t> serializeVox(const BenchCase& bench)
+{
+    std::vector<uint8_t> children;
+    for (size_t i = 0; i < bench.models.size(); i++) {
+        std::vector<uint8_t> content;
+        for (int axis = 0; axis < 3; axis++)
+            appendInt(content, bench.sizes[i][axis]);
+        appendChunk(children, "SIZE", content);
+
+        content.clear();
+        appendInt(content, bench.models[i].size());
+        const uint8_t* voxels = (const uint8_t*)bench.models[i].data();
+        content.insert(content.end(), voxels, voxels + bench.models[i].size() * 4);
+        appendChunk(children, "XYZI", content);
+    }
+
+    if (bench.scene) {
+        int numInstances = bench.models.size() * 2;
+        appendTransform(children, 0, 1, std::string());
+        std::vector<uint8_t> group;
+        appendInt(group, 1);
+        appendInt(group, 0);
+        appendInt(group, numInstances);
+        for (int i = 0; i < numInstances; i++)
+            appendInt(group, 2 + i * 2);
+        appendChunk(children, "nGRP", group);
+
+        for (int i = 0; i < numInstances; i++) {
+            int model = i % bench.models.size();
+            const ivec3& size = bench.sizes[model];
+            std::string translation = std::to_string((i % 8) * size[0]) + " " + std::to_string((i / 8) * size[1]) + " 0";
+            appendTransform(children, 2 + i * 2, 3 + i * 2, translation);
+
+            std::vector<uint8_t> shape;
+            appendInt(shape, 3 + i * 2);
+            appendInt(shape, 0);
+            appendInt(shape, 1);
+            appendInt(shape, model);
+            appendInt(shape, 0);
+            appendChunk(children, "nSHP", shape);
+        }
+    }
+
+    std::vector<uint8_t> palette;
+    for (int i = 0; i < 256; i++)
+        appendInt(palette, 0xff000000u | (i * 0x010101u));
+    appendChunk(children, "RGBA", palette);
+
+    std::vector<uint8_t> data;
+    data.insert(data.end(), {'V', 'O', 'X', ' '});
+    appendInt(data, 150);
+    appendChunk(data, "MAIN", std::vector<uint8_t>(), children.size());
+    data.insert(data.end(), children.begin(), children.end());
+    return data;
+}
+
+// data with a root node appended to MAIN, replacing the one of the scene,
+// whose chunk is malformed: a name running past the chunk, or a transform or
+// group counting more frames or children than the chunk holds
+static std::vector<uint8_t> appendMalformedRoot(const std::vector<uint8_t>& data, int kind)
+{
+    std::vector<uint8_t> content;
+    appendInt(content, 0);
+    if (kind == 0) {
+        appendInt(content, 1);
+        appendInt(content, 0x7ffffff0u);
+    } else {
+        appendInt(content, 0); // no attribute
+    }
+    if (kind == 1) {
+        appendInt(content, 1);
+        appendInt(content, -1);
+        appendInt(content, 0);
+        appendInt(content, 0x7fffffffu);
+    } else if (kind == 2) {
+        appendInt(content, 0x40000000u);
+    }
+
+    std::vector<uint8_t> malformed = data;
+    appendChunk(malformed, kind == 2 ? "nGRP" : "nTRN", content);
+    uint32_t childrenSize = malformed.size() - 20;
+    memcpy(&malformed[16], &childrenSize, 4);
+    return malformed;
+}
+
+struct Measure {
+    double seconds = 0;
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+};
+
+// fastest of repeat runs, allocations of that run
+template <typename Func>
+static Measure measure(int repeat, Func func)
+{
+    Measure best;
+    for (int i = 0; i < repeat; i++) {
+        uint64_t count = allocationCount;
+        uint64_t bytes = allocationBytes;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (i == 0 || elapsed.count() < best.seconds) {
+            best.seconds = elapsed.count();
+            best.allocations = allocationCount - count;
+            best.allocatedBytes = allocationBytes - bytes;
+        }
+    }
+    return best;
+}
+
+struct Report {
+    std::string json;
+
+    // meshBytes is the memory held by the meshes produced by the stage, extra
+    // more fields of the stage as "name": value pairs
+    void add(const std::string& bench, const std::string& stage, const Measure& result, uint64_t voxels,
+             uint64_t faces, uint64_t bytes, uint64_t meshBytes = 0, const std::string& extra = std::string())
+    {
+        double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+        char line[1024];
+        snprintf(line, sizeof(line),
+                 "%s    {\"case\": \"%s\", \"stage\": \"%s\", \"seconds\": %.6f, \"voxels\": %llu, \"faces\": %llu, "
+                 "\"bytes\": %llu, \"voxels_per_second\": %.0f, \"faces_per_second\": %.0f, \"mb_per_second\": %.2f, "
+                 "\"allocations\": %llu, \"allocated_bytes\": %llu, \"mesh_bytes\": %llu%s%s}",
+                 json.empty() ? "" : ",\n", bench.c_str(), stage.c_str(), result.seconds, (unsigned long long)voxels,
+                 (unsigned long long)faces, (unsigned long long)bytes, voxels / seconds, faces / seconds,
+                 bytes / seconds / (1024 * 1024), (unsigned long long)result.allocations,
+                 (unsigned long long)result.allocatedBytes, (unsigned long long)meshBytes, extra.empty() ? "" : ", ",
+                 extra.c_str());
+        json += line;
+
+        printf("%-18s %-12s %10.3f ms %12.0f voxels/s %12.0f faces/s %9.2f MB/s %10llu allocs", bench.c_str(),
+               stage.c_str(), result.seconds * 1000, voxels / seconds, faces / seconds,
+               bytes / seconds / (1024 * 1024), (unsigned long long)result.allocations);
+        if (meshBytes)
+            printf(" %9.2f MB meshes", meshBytes / (1024.0 * 1024.0));
+        if (!extra.empty())
+            printf(" %s", extra.c_str());
+        printf("\n");
+    }
+};
+
+static uint64_t countFaces(const std::vector<VoxelGroup>& meshes)
+{
+    uint64_t faces = 0;
+    for (const VoxelGroup& mesh : meshes)
+        for (VoxelGroup::const_iterator it = mesh.begin(); it != mesh.end(); it++)
+            faces += it->second.numFaces();
+    return faces;
+}
+
+template <typename T>
+static uint64_t arrayBytes(const std::vector<T>& array)
+{
+    return array.size() * sizeof(T);
+}
+
+static uint64_t meshBytes(const std::vector<VoxelGroup>& meshes)
+{
+    uint64_t bytes = 0;
+    for (const VoxelGroup& mesh : meshes) {
+        for (VoxelGroup::const_iterator it = mesh.begin(); it != mesh.end(); it++) {
+            const VoxelBuffer& buffer = it->second;
+            bytes += arrayBytes(buffer.vertexes) + arrayBytes(buffer.normals) + arrayBytes(buffer.faces) +
+                     arrayBytes(buffer.faceNormals) + arrayBytes(buffer.corners) + arrayBytes(buffer.quads16) +
+                     arrayBytes(buffer.quads32) + arrayBytes(buffer.faceMaterials) + arrayBytes(buffer.occlusion);
+        }
+    }
+    return bytes;
+}
+
+static uint64_t fileSize(const char* path)
+{
+    struct stat info;
+    return stat(path, &info) == 0 ? info.st_size : 0;
+}
+
+// Times every face mask kernel the cpu supports, returns false when one does
+// not give the bits of the scalar kernel
+static bool runFaceMasks(Report& report, const BenchCase& bench, const Options& options, uint64_t voxels)
+{
+    std::vector<VoxelGrid> grids(bench.models.size());
+    std::vector<VoxelFaceMasks> expected(bench.models.size());
+    for (size_t i = 0; i < bench.models.size(); i++) {
+        grids[i].build(bench.models[i]);
+        allocateFaceMasks(expected[i], grids[i]);
+        computeFaceMasks(expected[i], grids[i], 0, grids[i].size[0], FACE_MASK_SCALAR);
+    }
+
+    bool identical = true;
+    std::vector<VoxelFaceMasks> masks(grids.size());
+    for (int kernel = 0; kernel < NUM_FACE_MASK_KERNELS; kernel++) {
+        if (!faceMaskKernelSupported((FaceMaskKernel)kernel))
+            continue;
+        for (size_t i = 0; i < grids.size(); i++)
+            allocateFaceMasks(masks[i], grids[i]);
+        Measure result = measure(options.repeat, [&] {
+            for (size_t i = 0; i < grids.size(); i++)
+                computeFaceMasks(masks[i], grids[i], 0, grids[i].size[0], (FaceMaskKernel)kernel);
+        });
+        std::string name = faceMaskKernelName((FaceMaskKernel)kernel);
+        report.add(bench.name, "masks_" + name, result, voxels, 0, 0);
+
+        bool same = true;
+        for (size_t i = 0; i < grids.size(); i++) {
+            for (int f = 0; f < 6; f++)
+                same = same && masks[i].masks[f] == expected[i].masks[f];
+        }
+        if (!same) {
+            printf("%s: face masks of the %s kernel differ from the scalar ones\n", bench.name.c_str(), name.c_str());
+            identical = false;
+        }
+    }
+    return identical;
+}
+
+// Models of the case side by side in a ChunkedMesh, 512 voxels apart
+static void loadChunkedMesh(ChunkedMesh& chunked, const BenchCase& bench)
+{
+    for (size_t i = 0; i < bench.models.size(); i++)
+        chunked.setVoxels(bench.models[i], ivec3((int)i * 512, 0, 0));
+}
+
+static uint64_t countChunkFaces(const ChunkedMesh& chunked)
+{
+    std::vector<ivec3> coords;
+    chunked.getChunks(coords);
+    std::vector<VoxelGroup> meshes;
+    for (const ivec3& coord : coords)
+        meshes.push_back(*chunked.getMesh(coord));
+    return countFaces(meshes);
+}
+
+// Times meshing the case in 32^3 chunks then remeshing after toggling one
+// voxel at the center of the first model. Returns false when the chunk meshes
+// do not have the faces of the edited models meshed whole.
+static bool runRemesh(Report& report, const BenchCase& bench, const Options& options, ThreadPool* threadPool,
+                      uint64_t voxels)
+{
+    PolygonizeOptions polygonizeOptions;
+    polygonizeOptions.threadPool = threadPool;
+    std::vector<ivec3> changed;
+    Measure result = measure(options.repeat, [&] {
+        ChunkedMesh chunked(32, polygonizeOptions);
+        loadChunkedMesh(chunked, bench);
+        chunked.update(changed);
+    });
+    ChunkedMesh chunked(32, polygonizeOptions);
+    loadChunkedMesh(chunked, bench);
+    chunked.update(changed);
+    report.add(bench.name, "remesh_load", result, voxels, countChunkFaces(chunked), 0);
+
+    VoxelGrid grid;
+    grid.build(bench.models[0]);
+    ivec3 center(grid.min[0] + grid.size[0] / 2, grid.min[1] + grid.size[1] / 2, grid.min[2] + grid.size[2] / 2);
+    uint64_t remeshed = 0;
+    result = measure(options.repeat, [&] {
+        chunked.setVoxel(center, chunked.getVoxel(center) ? 0 : 1);
+        chunked.update(changed);
+        remeshed = changed.size();
+    });
+    char chunks[64];
+    snprintf(chunks, sizeof(chunks), "\"chunks\": %llu", (unsigned long long)remeshed);
+    report.add(bench.name, "remesh_edit", result, voxels, 0, 0, 0, chunks);
+
+    // the models as edited, meshed whole
+    VoxScene scene;
+    scene.voxels = bench.models;
+    VoxModel& first = scene.voxels[0];
+    MaterialID material = chunked.getVoxel(center);
+    first.erase(std::remove_if(first.begin(), first.end(),
+                               [&](const VoxelPos& voxel) {
+                                   return voxel[0] == center[0] && voxel[1] == center[1] && voxel[2] == center[2];
+                               }),
+                first.end());
+    if (material) {
+        VoxelPos voxel;
+        for (int axis = 0; axis < 3; axis++)
+            voxel[axis] = (uint8_t)center[axis];
+        voxel[3] = material;
+        first.push_back(voxel);
+    }
+    std::vector<VoxelGroup> meshes;
+    polygonize(meshes, scene, polygonizeOptions);
+
+    if (countChunkFaces(chunked) != countFaces(meshes)) {
+        printf("%s: chunk meshes have %llu faces instead of %llu\n", bench.name.c_str(),
+               (unsigned long long)countChunkFaces(chunked), (unsigned long long)countFaces(meshes));
+        return false;
+    }
+    return true;
+}
+
+static void printErrors(LogLevel level, const char* message, void*)
+{
+    if (level == LOG_ERROR)
+        fputs(message, stderr);
+}
+
+static bool writeFile(const std::string& path, const std::vector<uint8_t>& data)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool written = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    return fclose(fp) == 0 && written;
+}
+
+// Times a batch converting the case and 3 malformed copies of it to glb.
+// Returns false unless exactly the malformed copies fail and the batch goes on.
+static bool runBatch(Report& report, const BenchCase& bench, const Options& options, ThreadPool* threadPool,
+                     const std::vector<uint8_t>& data, uint64_t voxels)
+{
+    const char* directory = "vox2mesh_bench_batch";
+    mkdir(directory, 0755);
+    std::vector<std::string> files;
+    uint64_t bytes = 0;
+    for (int kind = -1; kind < 3; kind++) {
+        std::vector<uint8_t> file = kind < 0 ? data : appendMalformedRoot(data, kind);
+        files.push_back(std::string(directory) + "/" + bench.name + "_" + std::to_string(kind + 1) + ".vox");
+        if (!writeFile(files.back(), file)) {
+            printf("%s: cannot write %s\n", bench.name.c_str(), files.back().c_str());
+            return false;
+        }
+        bytes += file.size();
+    }
+
+    ConvertOptions convertOptions;
+    convertOptions.polygonize.threadPool = threadPool;
+    int failures = 0;
+    setLogCallback(nullptr);
+    Measure result = measure(options.repeat, [&] { failures = convertBatch(files, directory, "glb", convertOptions); });
+    setLogCallback(printErrors);
+    char failed[64];
+    snprintf(failed, sizeof(failed), "\"failed\": %d", failures);
+    report.add(bench.name, "batch", result, voxels, 0, bytes, 0, failed);
+
+    for (const std::string& file : files) {
+        unlink(file.c_str());
+        unlink((file.substr(0, file.size() - 3) + "glb").c_str());
+    }
+    rmdir(directory);
+
+    if (failures != 3) {
+        printf("%s: %d files of the batch failed instead of the 3 malformed ones\n", bench.name.c_str(), failures);
+        return false;
+    }
+    return true;
+}
+
+static bool runCase(Report& report, const BenchCase& bench, const Options& options, ThreadPool* threadPool)
+{
+    uint64_t voxels = 0;
+    for (const VoxModel& model : bench.models)
+        voxels += model.size();
+
+    std::vector<uint8_t> data = serializeVox(bench);
+    Measure result = measure(options.repeat, [&] {
+        VoxReader reader;
+        reader.loadVoxelsData(data.data(), data.size());
+    });
+    report.add(bench.name, "load", result, voxels, 0, data.size());
+
+    bool identical = runFaceMasks(report, bench, options, voxels);
+    identical = runRemesh(report, bench, options, threadPool, voxels) && identical;
+    identical = runBatch(report, bench, options, threadPool, data, voxels) && identical;
+
+    VoxScene scene;
+    scene.voxels = bench.models;
+
+    // compact_weld goes last, its meshes are the ones used by the next stages
+    const char* modes[] = {"polygonize", "greedy", "weld", "occlusion", "compact", "compact_weld"};
+    std::vector<VoxelGroup> meshes;
+    for (int mode = 0; mode < 6; mode++) {
+        PolygonizeOptions polygonizeOptions;
+        polygonizeOptions.greedy = mode == 1;
+        polygonizeOptions.weld = mode == 2 || mode == 3 || mode == 5;
+        polygonizeOptions.occlusion = mode == 3;
+        polygonizeOptions.compact = mode >= 4;
+        polygonizeOptions.threadPool = threadPool;
+        result = measure(options.repeat, [&] {
+            std::vector<VoxelGroup>().swap(meshes);
+            polygonize(meshes, scene, polygonizeOptions);
+        });
+        report.add(bench.name, modes[mode], result, voxels, countFaces(meshes), 0, meshBytes(meshes));
+    }
+
+    // triangles of the welded meshes ordered for a 32 entries vertex cache,
+    // with the average cache misses per triangle before and after
+    float missesBefore = 0, missesAfter = 0;
+    float triangleWeight = 1.0f / (2 * countFaces(meshes));
+    std::vector<TriangleList> lists;
+    for (const VoxelGroup& mesh : meshes) {
+        for (VoxelGroup::const_iterator it = mesh.begin(); it != mesh.end(); it++) {
+            TriangleList list;
+            triangulate(list, it->second, false);
+            missesBefore +=
+                averageCacheMissRatio(list.indexes, list.vertexes.size(), 32) * list.faces.size() * triangleWeight;
+        }
+    }
+    result = measure(options.repeat, [&] {
+        lists.clear();
+        for (const VoxelGroup& mesh : meshes) {
+            for (VoxelGroup::const_iterator it = mesh.begin(); it != mesh.end(); it++) {
+                lists.push_back(TriangleList());
+                triangulate(lists.back(), it->second, true);
+            }
+        }
+    });
+    for (const TriangleList& list : lists)
+        missesAfter += averageCacheMissRatio(list.indexes, list.vertexes.size(), 32) * list.faces.size() * triangleWeight;
+    char misses[128];
+    snprintf(misses, sizeof(misses), "\"acmr_before\": %.3f, \"acmr_after\": %.3f", missesBefore, missesAfter);
+    report.add(bench.name, "triangles", result, voxels, countFaces(meshes), 0, 0, misses);
+    std::vector<TriangleList>().swap(lists);
+
+    // writers are timed on the meshes of the default mode
+    std::vector<VoxelGroup>().swap(meshes);
+    std::vector<VoxelGroup> plain;
+    PolygonizeOptions plainOptions;
+    plainOptions.threadPool = threadPool;
+    polygonize(plain, scene, plainOptions);
+    uint64_t faces = countFaces(plain);
+
+    const char* extensions[] = {"obj", "glb"};
+    for (const char* extension : extensions) {
+        std::string path = "vox2mesh_bench_output." + std::string(extension);
+        result = measure(options.repeat, [&] {
+            std::unique_ptr<MeshWriter> writer(createMeshWriter(path.c_str(), threadPool));
+            writer->open(path.c_str());
+            for (size_t i = 0; i < plain.size(); i++)
+                writer->write(plain[i], "model_" + std::to_string(i));
+            writer->close();
+        });
+        report.add(bench.name, std::string("write_") + extension, result, voxels, faces, fileSize(path.c_str()));
+        unlink(path.c_str());
+    }
+    return identical;
+}
+
+int parseArgument(Options& options, int argc, char** argv)
+{
+    int opt;
+    int optionIndex = 0;
+
+    static const char* OPTSTR = "hs:r:j:c:o:";
+    static const struct option OPTIONS[] = {
+        {"help", no_argument, nullptr, 'h'},
+        {"size", required_argument, nullptr, 's'},
+        {"repeat", required_argument, nullptr, 'r'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"case", required_argument, nullptr, 'c'},
+        {"output", required_argument, nullptr, 'o'},
+        {nullptr, 0, 0, 0} // termination of the option list
+    };
+
+    while ((opt = getopt_long(argc, argv, OPTSTR, OPTIONS, &optionIndex)) >= 0) {
+        const char* arg = optarg ? optarg : "";
+        switch (opt) {
+        case 's':
+            options.size = atoi(arg);
+            options.size = options.size < 8 ? 8 : options.size > 256 ? 256 : options.size;
+            break;
+        case 'r':
+            options.repeat = atoi(arg) > 0 ? atoi(arg) : 1;
+            break;
+        case 'j':
+            options.jobs = atoi(arg);
+            if (options.jobs <= 0)
+                options.jobs = std::thread::hardware_concurrency();
+            break;
+        case 'c':
+            options.filter = arg;
+            break;
+        case 'o':
+            options.outputFile = arg;
+            break;
+        default:
+        case 'h':
+            printUsage();
+            exit(0);
+            break;
+        }
+    }
+    return optind;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    parseArgument(options, argc, argv);
+    setLogCallback(printErrors);
+
+    std::unique_ptr<ThreadPool> threadPool;
+    if (options.jobs > 1)
+        threadPool.reset(new ThreadPool(options.jobs));
+
+    // cases are generated one at a time to bound the memory used
+    typedef BenchCase (*Generator)(int);
+    struct {
+        const char* name;
+        Generator generate;
+        int size;
+    } cases[] = {
+        {"solid_cube", solidCube, options.size},
+        {"hollow_sphere", hollowSphere, options.size},
+        {"noise_terrain", terrain, options.size},
+        {"checkerboard", checkerboard, options.size / 4},
+        {"multi_model_scene", multiModel, options.size / 4},
+    };
+
+    Report report;
+    bool identical = true;
+    for (const auto& generator : cases) {
+        if (!strstr(generator.name, options.filter))
+            continue;
+        identical = runCase(report, generator.generate(generator.size), options, threadPool.get()) && identical;
+    }
+
+    FILE* fp = fopen(options.outputFile, "w");
+    if (!fp) {
+        printf("Failed to open %s\n", options.outputFile);
+        return 1;
+    }
+    fprintf(fp, "{\n  \"size\": %d,\n  \"repeat\": %d,\n  \"jobs\": %d,\n  \"results\": [\n%s\n  ]\n}\n", options.size,
+            options.repeat, options.jobs, report.json.c_str());
+    fclose(fp);
+    return identical ? 0 : 1;
+}
@@ -1,13 +1,43 @@
 #include <getopt.h>
+#include <memory>
 
+#include "Convert.h"
+#include "Log.h"
+#include "MeshCache.h"
+#include "Stats.h"
+#include "ThreadPool.h"
 #include "VoxReader.h"
-#include "polygonize.h"
 
 void printUsage()
 {
     const char* text = "vox2obj is a tool to convert vox to obj\n"
                        "usages:\n"
-                       " vox2obj input.vox output.obj\n"
+                       " vox2obj [options] input.vox output.obj\n"
+                       " vox2obj [options] input.vox output.glb\n"
+                       " vox2obj [options] --batch outdir inputs...\n"
+                       "options:\n"
+                       " -g, --greedy   merge coplanar faces of the same material\n"
+                       " -w, --weld     share vertexes between faces and write the 6 normals once\n"
+                       " -k, --compact  keep meshes in 16 bits positions and indexes, same output\n"
+                       " -T, --triangles write triangles ordered for the GPU vertex cache instead of quads\n"
+                       " -P, --palette  one mesh for all materials textured with a 256x1 palette image\n"
+                       " -A, --occlusion bake ambient occlusion per vertex, written as a gray vertex color\n"
+                       " -j, --jobs N   mesh with N threads, 0 for one per core\n"
+                       " -m, --model N  convert model N alone instead of the scene\n"
+                       " -b, --bake     bake scene instances into a single mesh, always done for obj\n"
+                       " -l, --list     list the models and nodes of input.vox without converting\n"
+                       " -p, --pipeline convert all models, overlapping decoding, meshing and writing\n"
+                       " -W, --world    mesh the scene as one world in chunks, culling faces between models\n"
+                       " -L, --lod N    write N levels of detail of each model, each one half the previous\n"
+                       " -F, --frames FPS convert every animation frame, played at FPS frames a second\n"
+                       " -B, --batch DIR convert every input into DIR, inputs being .vox files,\n"
+                       "                directories, glob patterns or manifests listing one per line\n"
+                       " -t, --type EXT output extension in batch mode, obj by default\n"
+                       " -c, --cache DIR reuse meshes of unchanged models stored in DIR\n"
+                       " -C, --cache-size MB evict least recently used meshes above MB, 1024 by default\n"
+                       " -s, --stats    print time per stage, model counts, bytes written and peak memory\n"
+                       " -S, --stats-json FILE write the same statistics as JSON to FILE\n"
+                       " -h, --help     print this help\n"
                        "\n";
 
     printf("%s", text);
@@ -17,24 +47,116 @@ struct Options {
     const char* inputFile = 0;
     const char* outputFile = "output.obj";
     int cleanFaces = 1;
+    const char* batchDir = 0;
+    const char* batchType = "obj";
+    const char* cacheDir = 0;
+    int cacheSize = 1024;
+    const char* statsFile = 0;
+    int stats = 0;
+    int jobs = 1;
+    int list = 0;
+    ConvertOptions convert;
 };
 
-int parseArgument(Options&, int argc, char** argv)
+int parseArgument(Options& options, int argc, char** argv)
 {
     int opt;
     int optionIndex = 0;
 
-    static const char* OPTSTR = "h";
+    static const char* OPTSTR = "hgwkTPAj:m:blpWL:F:B:t:c:C:sS:";
     static const struct option OPTIONS[] = {
-        {"help", no_argument, nullptr, 'h'}, {nullptr, 0, 0, 0} // termination of the option list
+        {"help", no_argument, nullptr, 'h'},
+        {"greedy", no_argument, nullptr, 'g'},
+        {"weld", no_argument, nullptr, 'w'},
+        {"compact", no_argument, nullptr, 'k'},
+        {"triangles", no_argument, nullptr, 'T'},
+        {"palette", no_argument, nullptr, 'P'},
+        {"occlusion", no_argument, nullptr, 'A'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"model", required_argument, nullptr, 'm'},
+        {"bake", no_argument, nullptr, 'b'},
+        {"list", no_argument, nullptr, 'l'},
+        {"pipeline", no_argument, nullptr, 'p'},
+        {"world", no_argument, nullptr, 'W'},
+        {"lod", required_argument, nullptr, 'L'},
+        {"frames", required_argument, nullptr, 'F'},
+        {"batch", required_argument, nullptr, 'B'},
+        {"type", required_argument, nullptr, 't'},
+        {"cache", required_argument, nullptr, 'c'},
+        {"cache-size", required_argument, nullptr, 'C'},
+        {"stats", no_argument, nullptr, 's'},
+        {"stats-json", required_argument, nullptr, 'S'},
+        {nullptr, 0, 0, 0} // termination of the option list
     };
 
     while ((opt = getopt_long(argc, argv, OPTSTR, OPTIONS, &optionIndex)) >= 0) {
-        // const char *arg = optarg ? optarg : "";
+        const char* arg = optarg ? optarg : "";
         if (opt == -1)
             break;
 
         switch (opt) {
+        case 'g':
+            options.convert.polygonize.greedy = true;
+            break;
+        case 'w':
+            options.convert.polygonize.weld = true;
+            break;
+        case 'k':
+            options.convert.polygonize.compact = true;
+            break;
+        case 'T':
+            options.convert.triangles = true;
+            break;
+        case 'P':
+            options.convert.polygonize.atlas = true;
+            break;
+        case 'A':
+            options.convert.polygonize.occlusion = true;
+            break;
+        case 'j':
+            options.jobs = atoi(arg);
+            if (options.jobs <= 0)
+                options.jobs = std::thread::hardware_concurrency();
+            break;
+        case 'm':
+            options.convert.model = atoi(arg);
+            break;
+        case 'b':
+            options.convert.bake = true;
+            break;
+        case 'l':
+            options.list = 1;
+            break;
+        case 'p':
+            options.convert.pipeline = true;
+            break;
+        case 'W':
+            options.convert.world = true;
+            break;
+        case 'L':
+            options.convert.lods = atoi(arg);
+            break;
+        case 'F':
+            options.convert.frameRate = atoi(arg);
+            break;
+        case 'B':
+            options.batchDir = arg;
+            break;
+        case 't':
+            options.batchType = arg;
+            break;
+        case 'c':
+            options.cacheDir = arg;
+            break;
+        case 'C':
+            options.cacheSize = atoi(arg);
+            break;
+        case 's':
+            options.stats = 1;
+            break;
+        case 'S':
+            options.statsFile = arg;
+            break;
         default:
         case 'h':
             printUsage();
@@ -45,8 +167,22 @@ int parseArgument(Options&, int argc, char** argv)
     return optind;
 }
 
+// Only reads the chunk index, no model or node is decoded
+static void listModels(VoxReader& reader)
+{
+    printf("%d models, %d nodes\n", reader.getNumModels(), reader.getNumNodes());
+    for (int i = 0; i < reader.getNumModels(); i++) {
+        const VoxModelInfo& info = reader.getModelInfo(i);
+        printf("model %d: %u x %u x %u, %u voxels\n", i, info.sizeX, info.sizeY, info.sizeZ, info.numVoxels);
+    }
+}
+
+// messages of the library are printed as they were before it logged them
+static void printMessage(LogLevel, const char* message, void*) { fputs(message, stdout); }
+
 int main(int argc, char** argv)
 {
+    setLogCallback(printMessage);
 
     Options options;
     int optionIndex = parseArgument(options, argc, argv);
@@ -62,16 +198,56 @@ int main(int argc, char** argv)
         options.outputFile = argv[optionIndex + 1];
     }
 
-    VoxReader reader;
-    if (!reader.readFile(options.inputFile)) {
-        printf("error reading voxels\n");
-        return 1;
+    if (options.list) {
+        VoxReader reader;
+        if (!reader.openFile(options.inputFile)) {
+            printf("error reading voxels\n");
+            return 1;
+        }
+        listModels(reader);
+        return 0;
+    }
+
+    std::unique_ptr<ThreadPool> threadPool;
+    if (options.jobs > 1) {
+        threadPool.reset(new ThreadPool(options.jobs));
+        options.convert.polygonize.threadPool = threadPool.get();
+    }
+
+    MeshCache cache;
+    if (options.cacheDir) {
+        if (!cache.open(options.cacheDir, (uint64_t)options.cacheSize << 20))
+            return 1;
+        options.convert.polygonize.cache = &cache;
     }
 
-    std::vector<VoxelGroup> meshList;
+    Stats stats;
+    if (options.stats || options.statsFile)
+        options.convert.polygonize.stats = &stats;
+
+    bool converted;
+    if (options.batchDir) {
+        std::vector<std::string> files;
+        bool found = collectBatchFiles(files, std::vector<std::string>(argv + optionIndex, argv + argc));
+        int failures = convertBatch(files, options.batchDir, options.batchType, options.convert);
+        converted = found && failures == 0;
+    } else {
+        converted = convertFile(options.inputFile, options.outputFile, options.convert);
+    }
 
-    polygonize(meshList, reader.getVoxelScene());
+    if (options.cacheDir)
+        cache.trim();
 
-    // write an obj
-    return writeOBJ(meshList[0], options.outputFile);
+    if (options.stats)
+        stats.print(stdout);
+    if (options.statsFile) {
+        FILE* fp = fopen(options.statsFile, "w");
+        if (!fp) {
+            printf("Failed to open %s\n", options.statsFile);
+            return 1;
+        }
+        stats.printJSON(fp);
+        fclose(fp);
+    }
+    return converted ? 0 : 1;
 }
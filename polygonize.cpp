@@ -1,36 +1,11 @@
 #include "polygonize.h"
+#include "ThreadPool.h"
 #include "VoxReader.h"
+#include "VoxelGrid.h"
 
-typedef uint8_t VoxelFaceFlags;
-
-struct VoxelData {
-    uint8_t v[4];
-    VoxelData(uint8_t x, uint8_t y, uint8_t z, uint8_t material)
-        : v{x, y, z, material}
-    {}
-    VoxelData() {}
-    inline uint8_t& operator[](int index) { return v[index]; }
-    inline uint8_t operator[](int index) const { return v[index]; }
-};
-
-struct cmpVoxel {
-    bool operator()(const ucvec3& a, const ucvec3& b) const
-    {
-        if (a[0] < b[0]) {
-            return true;
-        } else if (a[0] == b[0]) {
-            if (a[1] < b[1]) {
-                return true;
-            } else if (a[1] == b[1]) {
-                if (a[2] < b[2])
-                    return true;
-            }
-        }
-        return false;
-    }
-};
-typedef std::map<ucvec3, MaterialID, cmpVoxel> VoxelMap;
-typedef std::map<ucvec3, VoxelFaceFlags, cmpVoxel> VoxelMapFlags;
+#include <algorithm>
+#include <math.h>
+#include <unordered_map>
 
 // face 0 x+: 3 2 6 7
 // face 1 y+: 1 5 6 2
@@ -45,6 +20,12 @@ fvec3 NormalFace[] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {-1, 0, 0}, {0, -1, 0}, {
 fvec3 VertexesVoxel[] = {{-0.5, -0.5, 0.5},  {-0.5, 0.5, 0.5},  {0.5, 0.5, 0.5},  {0.5, -0.5, 0.5},
                          {-0.5, -0.5, -0.5}, {-0.5, 0.5, -0.5}, {0.5, 0.5, -0.5}, {0.5, -0.5, -0.5}};
 
+const float OcclusionLight[4] = {0.4f, 0.6f, 0.8f, 1.0f};
+
+// occlusion levels of the 4 corners of a face, 2 bits each in the order of
+// FacesVoxel, when every corner is at level 3
+static const uint8_t Unoccluded = 0xff;
+
 enum FaceFlag : uint8_t {
     NONE = 0,
     PX = 1 << 0,
@@ -57,112 +38,555 @@ enum FaceFlag : uint8_t {
 };
 ivec3 VoxelDirection[] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {-1, 0, 0}, {0, -1, 0}, {0, 0, -1}};
 
-void polygonize(VoxelGroup& voxelGroup, const VoxModel& voxModel)
+// Position of a voxel corner on the integer lattice, packed as 21 bits per axis.
+static inline uint64_t latticeKey(const fvec3& v)
 {
+    const int bias = 1 << 20;
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; axis++)
+        key = (key << 21) | (uint64_t)((int)floorf(v[axis] + 0.5f) + bias);
+    return key;
+}
 
-    VoxelMap voxelMap;
-    VoxelMapFlags voxelMapFlags;
+static inline uint64_t latticeKey(const svec3& corner)
+{
+    const int bias = 1 << 20;
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; axis++)
+        key = (key << 21) | (uint64_t)(corner[axis] + bias);
+    return key;
+}
 
-    ucvec3 min(255, 255, 255);
-    ucvec3 max(0, 0, 0);
-    // fill the map
-    for (const VoxelPos& voxelData : voxModel) {
-        min[0] = voxelData[0] < min[0] ? voxelData[0] : min[0];
-        min[1] = voxelData[1] < min[1] ? voxelData[1] : min[1];
-        min[2] = voxelData[2] < min[2] ? voxelData[2] : min[2];
+// weld map of the corners of a material at an occlusion level
+static inline int weldSet(MaterialID materialID, uint8_t level) { return materialID | level << 8; }
 
-        max[0] = voxelData[0] > max[0] ? voxelData[0] : max[0];
-        max[1] = voxelData[1] > max[1] ? voxelData[1] : max[1];
-        max[2] = voxelData[2] > max[2] ? voxelData[2] : max[2];
+static inline svec3 latticeCorner(const fvec3& v)
+{
+    return svec3((int16_t)floorf(v[0] + 0.5f), (int16_t)floorf(v[1] + 0.5f), (int16_t)floorf(v[2] + 0.5f));
+}
 
-        ucvec3 voxelPosition(voxelData[0], voxelData[1], voxelData[2]);
+void VoxelBuffer::addCorner(const svec3& corner)
+{
+    // the next corner has index 65536, quads move to 32 bits indexes
+    if (corners.size() == 65536) {
+        quads32.assign(quads16.begin(), quads16.end());
+        std::vector<uint16_t>().swap(quads16);
+    }
+    corners.push_back(corner);
+}
 
-        voxelMapFlags[voxelPosition] = FaceFlag::NONE;
-        voxelMap[voxelPosition] = voxelData[3];
+void VoxelBuffer::addQuad(const Face& quad, uint8_t direction)
+{
+    for (int j = 0; j < 4; j++) {
+        if (corners.size() > 65536)
+            quads32.push_back(quad[j]);
+        else
+            quads16.push_back((uint16_t)quad[j]);
     }
-    printf("bbox %d %d %d - %d %d %d\n", (int)min[0], (int)min[1], (int)min[2], (int)max[0], (int)max[1], (int)max[2]);
-
-    for (int x = min[0]; x <= max[0]; x++)
-        for (int y = min[1]; y <= max[1]; y++)
-            for (int z = min[2]; z <= max[2]; z++) {
-                ucvec3 voxelPosition(x, y, z);
-                VoxelMapFlags::iterator voxel = voxelMapFlags.find(voxelPosition);
-                if (voxel == voxelMapFlags.end())
-                    continue;
+    faceNormals.push_back(direction);
+}
+
+void VoxelBuffer::expand()
+{
+    if (!compact)
+        return;
+
+    vertexes.resize(corners.size());
+    for (size_t i = 0; i < corners.size(); i++)
+        vertexes[i] = vertex(i);
+    faces.resize(numFaces());
+    for (size_t i = 0; i < faces.size(); i++)
+        faces[i] = face(i);
+    // unwelded faces take their normal from the 4 corners in order
+    if (!welded) {
+        normals.resize(corners.size());
+        for (size_t i = 0; i < normals.size(); i++)
+            normals[i] = NormalFace[faceNormals[i / 4]];
+        std::vector<uint8_t>().swap(faceNormals);
+    }
+
+    compact = false;
+    welded = false;
+    std::vector<svec3>().swap(corners);
+    std::vector<uint16_t>().swap(quads16);
+    std::vector<uint32_t>().swap(quads32);
+}
+
+void VoxelBuffer::translate(const ivec3& offset)
+{
+    bool fits = true;
+    for (size_t i = 0; fits && i < corners.size(); i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            int moved = corners[i][axis] + offset[axis];
+            fits = fits && moved >= INT16_MIN && moved <= INT16_MAX;
+        }
+    }
+    if (!fits)
+        expand();
+
+    fvec3 floatOffset((float)offset[0], (float)offset[1], (float)offset[2]);
+    for (fvec3& vertex : vertexes)
+        vertex += floatOffset;
+    for (svec3& corner : corners) {
+        for (int axis = 0; axis < 3; axis++)
+            corner[axis] += offset[axis];
+    }
+}
+
+// Push quads into the VoxelBuffer of their material, or all of them in the
+// buffer of material 0 for an atlas. When welding, corners are shared within
+// a material and occlusion level, and faces reference their normal by
+// direction.
+struct QuadEmitter {
+    VoxelGroup& voxelGroup;
+    bool weld;
+    bool compact;
+    bool atlas;
+    bool occlusion;
+    std::map<int, std::unordered_map<uint64_t, int>> vertexIndexes;
+
+    QuadEmitter(VoxelGroup& group, const PolygonizeOptions& options)
+        : voxelGroup(group)
+        , weld(options.weld)
+        , compact(options.compact)
+        , atlas(options.atlas)
+        , occlusion(options.occlusion)
+    {}
 
-                // check +x -x
-                ucvec3 nextVoxel;
-                for (int axis = 0; axis < 3; axis++) {
-                    nextVoxel = voxelPosition;
-
-                    if (voxelPosition[axis] == min[axis]) {
-                        voxel->second = voxel->second | (1 << (axis + 3));
-                    } else {
-                        nextVoxel[axis] = voxelPosition[axis] - 1;
-                        if (voxelMapFlags.find(nextVoxel) == voxelMapFlags.end()) {
-                            voxel->second = voxel->second | (1 << (axis + 3));
+    VoxelBuffer& buffer(MaterialID materialID)
+    {
+        VoxelBuffer& voxelBuffer = voxelGroup[materialID];
+        voxelBuffer.compact = compact;
+        voxelBuffer.welded = compact && weld;
+        return voxelBuffer;
+    }
+
+    inline void addVertex(VoxelBuffer& voxelBuffer, const fvec3& v, uint8_t level)
+    {
+        if (compact)
+            voxelBuffer.addCorner(latticeCorner(v));
+        else
+            voxelBuffer.vertexes.push_back(v);
+        if (occlusion)
+            voxelBuffer.occlusion.push_back(level);
+    }
+
+    inline void addFace(VoxelBuffer& voxelBuffer, const Face& quad, int f, MaterialID materialID)
+    {
+        if (atlas)
+            voxelBuffer.faceMaterials.push_back(materialID);
+        if (compact) {
+            voxelBuffer.addQuad(quad, f);
+            return;
+        }
+        if (weld)
+            voxelBuffer.faceNormals.push_back(f);
+        voxelBuffer.faces.push_back(quad);
+    }
+
+    // Emit the face of direction f covering the voxels from lo to hi included.
+    // Corners are taken from the unit voxel and pushed to the lo or hi side.
+    // occlusionLevels are the ones of the corners, see faceOcclusion.
+    void emit(MaterialID materialID, int f, const fvec3& lo, const fvec3& hi, uint8_t occlusionLevels = Unoccluded)
+    {
+        VoxelBuffer& voxelBuffer = buffer(atlas ? 0 : materialID);
+
+        Face face = FacesVoxel[f];
+        Face quad(0, 1, 2, 3);
+
+        uint8_t levels[4];
+        for (int j = 0; j < 4; j++)
+            levels[j] = (occlusionLevels >> (j * 2)) & 3;
+
+        // quads are split along their 0-2 diagonal, the corners are rotated
+        // when the 1-3 one is brighter so the darkening is not stretched
+        int first = levels[1] + levels[3] > levels[0] + levels[2] ? 1 : 0;
+
+        fvec3 corners[4];
+        uint8_t cornerLevels[4];
+        for (int j = 0; j < 4; j++) {
+            int corner = (j + first) & 3;
+            fvec3 v = VertexesVoxel[face[corner]];
+            for (int axis = 0; axis < 3; axis++)
+                v[axis] += v[axis] < 0 ? lo[axis] : hi[axis];
+            corners[j] = v;
+            cornerLevels[j] = levels[corner];
+        }
+
+        if (weld) {
+            std::unordered_map<uint64_t, int>* indexes = nullptr;
+            for (int j = 0; j < 4; j++) {
+                if (!j || cornerLevels[j] != cornerLevels[j - 1])
+                    indexes = &vertexIndexes[weldSet(materialID, cornerLevels[j])];
+                std::pair<std::unordered_map<uint64_t, int>::iterator, bool> inserted =
+                    indexes->insert(std::make_pair(latticeKey(corners[j]), (int)voxelBuffer.numVertexes()));
+                if (inserted.second)
+                    addVertex(voxelBuffer, corners[j], cornerLevels[j]);
+                quad[j] = inserted.first->second;
+            }
+        } else {
+            int vertexBaseIndex = voxelBuffer.numVertexes();
+            fvec3 normal = NormalFace[f];
+            for (int j = 0; j < 4; j++) {
+                addVertex(voxelBuffer, corners[j], cornerLevels[j]);
+                if (!compact)
+                    voxelBuffer.normals.push_back(normal);
+            }
+            quad += vertexBaseIndex;
+        }
+
+        addFace(voxelBuffer, quad, f, materialID);
+    }
+
+    // Append the output of another emitter with the same settings, welding
+    // its corners with the ones already emitted. Appending parts in order
+    // gives the same buffers as emitting all their quads here.
+    void append(const VoxelGroup& part)
+    {
+        for (VoxelGroup::const_iterator it = part.begin(); it != part.end(); it++) {
+            const VoxelBuffer& src = it->second;
+            VoxelBuffer& dst = buffer(it->first);
+            dst.faceMaterials.insert(dst.faceMaterials.end(), src.faceMaterials.begin(), src.faceMaterials.end());
+
+            // corners are welded within the material of their faces and
+            // their occlusion level
+            std::vector<int> weldSets;
+            if (weld) {
+                weldSets.assign(src.numVertexes(), it->first);
+                for (size_t i = 0; i < src.faceMaterials.size(); i++) {
+                    Face face = src.face(i);
+                    for (int j = 0; j < 4; j++)
+                        weldSets[face[j]] = src.faceMaterials[i];
+                }
+                for (size_t i = 0; i < weldSets.size(); i++)
+                    weldSets[i] = weldSet(weldSets[i], occlusion ? src.occlusion[i] : 3);
+            }
+
+            if (compact) {
+                std::vector<int> remap(src.corners.size());
+                for (size_t i = 0; i < src.corners.size(); i++) {
+                    int index = dst.corners.size();
+                    if (weld) {
+                        std::pair<std::unordered_map<uint64_t, int>::iterator, bool> inserted =
+                            vertexIndexes[weldSets[i]].insert(std::make_pair(latticeKey(src.corners[i]), index));
+                        index = inserted.first->second;
+                        if (!inserted.second) {
+                            remap[i] = index;
+                            continue;
                         }
                     }
+                    dst.addCorner(src.corners[i]);
+                    if (occlusion)
+                        dst.occlusion.push_back(src.occlusion[i]);
+                    remap[i] = index;
+                }
+                for (size_t i = 0; i < src.numFaces(); i++) {
+                    Face face = src.face(i);
+                    dst.addQuad(Face(remap[face[0]], remap[face[1]], remap[face[2]], remap[face[3]]),
+                                src.faceNormals[i]);
+                }
+            } else if (weld) {
+                std::vector<int> remap(src.vertexes.size());
+                for (size_t i = 0; i < src.vertexes.size(); i++) {
+                    std::pair<std::unordered_map<uint64_t, int>::iterator, bool> inserted =
+                        vertexIndexes[weldSets[i]].insert(
+                            std::make_pair(latticeKey(src.vertexes[i]), (int)dst.vertexes.size()));
+                    if (inserted.second) {
+                        dst.vertexes.push_back(src.vertexes[i]);
+                        if (occlusion)
+                            dst.occlusion.push_back(src.occlusion[i]);
+                    }
+                    remap[i] = inserted.first->second;
+                }
+                for (const Face& face : src.faces)
+                    dst.faces.push_back(Face(remap[face[0]], remap[face[1]], remap[face[2]], remap[face[3]]));
+                dst.faceNormals.insert(dst.faceNormals.end(), src.faceNormals.begin(), src.faceNormals.end());
+            } else {
+                int vertexBaseIndex = dst.vertexes.size();
+                dst.vertexes.insert(dst.vertexes.end(), src.vertexes.begin(), src.vertexes.end());
+                dst.normals.insert(dst.normals.end(), src.normals.begin(), src.normals.end());
+                dst.occlusion.insert(dst.occlusion.end(), src.occlusion.begin(), src.occlusion.end());
+                for (Face face : src.faces) {
+                    face += vertexBaseIndex;
+                    dst.faces.push_back(face);
+                }
+            }
+        }
+    }
+};
 
-                    if (voxelPosition[axis] == max[axis]) {
-                        voxel->second = voxel->second | (1 << axis);
-                    } else {
-                        nextVoxel[axis] = voxelPosition[axis] + 1;
-                        if (voxelMapFlags.find(nextVoxel) == voxelMapFlags.end()) {
-                            voxel->second = voxel->second | (1 << axis);
+// Models are split in slabs of this size along one axis to be meshed in
+// parallel. It does not depend on the number of threads so neither does the
+// output.
+static const int SlabSize = 16;
+
+// A slab of the model to mesh: x range for per voxel faces, or slice range
+// along the axis of direction for greedy meshing.
+struct MeshUnit {
+    int direction;
+    int begin;
+    int end;
+};
+
+static inline bool isSolidAt(const VoxelGrid& grid, const ivec3& p)
+{
+    for (int axis = 0; axis < 3; axis++) {
+        if (p[axis] < 0 || p[axis] >= grid.size[axis])
+            return false;
+    }
+    return grid.isSolid(p[0], p[1], p[2]);
+}
+
+// Occlusion levels of the corners of face f of the voxel at p. A corner is
+// darkened by the 2 voxels along its edges and the one at its tip in the
+// layer in front of the face, it is fully dark when both edges are solid.
+static uint8_t faceOcclusion(const VoxelGrid& grid, int x, int y, int z, int f)
+{
+    int d = f % 3;
+    int u = (d + 1) % 3;
+    int v = (d + 2) % 3;
+    ivec3 front = ivec3(x, y, z) + VoxelDirection[f];
+
+    // the 3x3 voxels of the layer in front, indexed by (du + 1) * 3 + dv + 1,
+    // bounds are only checked next to the sides of the grid
+    bool inside = true;
+    for (int axis = 0; axis < 3; axis++)
+        inside = inside && front[axis] >= 1 && front[axis] + 1 < grid.size[axis];
+    bool around[9];
+    for (int du = -1; du <= 1; du++) {
+        for (int dv = -1; dv <= 1; dv++) {
+            ivec3 p = front;
+            p[u] += du;
+            p[v] += dv;
+            around[(du + 1) * 3 + dv + 1] = inside ? grid.isSolid(p[0], p[1], p[2]) : isSolidAt(grid, p);
+        }
+    }
+
+    uint8_t levels = 0;
+    for (int j = 0; j < 4; j++) {
+        const fvec3& corner = VertexesVoxel[FacesVoxel[f][j]];
+        int du = corner[u] < 0 ? 0 : 2;
+        int dv = corner[v] < 0 ? 0 : 2;
+        int edges = around[du * 3 + 1] + around[3 + dv];
+        int level = edges == 2 ? 0 : 3 - edges - around[du * 3 + dv];
+        levels |= level << (j * 2);
+    }
+    return levels;
+}
+
+static int polygonizeFaces(QuadEmitter& emitter, const VoxelGrid& grid, const VoxelFaceMasks& faceMasks, int xBegin,
+                           int xEnd)
+{
+    int nbFaces = 0;
+    for (int x = xBegin; x < xEnd; x++) {
+        for (int y = 0; y < grid.size[1]; y++) {
+            size_t base = (size_t)grid.rowIndex(x, y) * grid.wordsPerRow;
+            for (int w = 0; w < grid.wordsPerRow; w++) {
+                uint64_t exposed = 0;
+                for (int f = 0; f < 6; f++)
+                    exposed |= faceMasks.masks[f][base + w];
+
+                while (exposed) {
+                    int bit = countTrailingZeros(exposed);
+                    exposed &= exposed - 1;
+
+                    int z = w * 64 + bit;
+                    MaterialID materialID = grid.material(x, y, z);
+                    fvec3 voxelPosition((float)(grid.min[0] + x), (float)(grid.min[1] + y), (float)(grid.min[2] + z));
+
+                    // insert all faces
+                    for (int f = 0; f < 6; f++) {
+                        if ((faceMasks.masks[f][base + w] >> bit) & 1) {
+                            uint8_t levels = emitter.occlusion ? faceOcclusion(grid, x, y, z, f) : Unoccluded;
+                            emitter.emit(materialID, f, voxelPosition, voxelPosition, levels);
+                            nbFaces++;
                         }
                     }
                 }
             }
+        }
+    }
+    return nbFaces;
+}
 
+// Greedy meshing: for each slice along the axis of direction f, exposed faces
+// sharing a material and occlusion levels are merged into maximal rectangles.
+static int polygonizeGreedy(QuadEmitter& emitter, const VoxelGrid& grid, const VoxelFaceMasks& faceMasks, int f,
+                            int sliceBegin, int sliceEnd)
+{
     int nbFaces = 0;
-    for (VoxelMapFlags::iterator it = voxelMapFlags.begin(); it != voxelMapFlags.end(); it++) {
-        ucvec3 position = it->first;
-        MaterialID materialID = voxelMap[position];
-        uint8_t faceFlags = it->second;
+    const std::vector<uint64_t>& mask = faceMasks.masks[f];
+    int d = f % 3;
+    int u = (d + 1) % 3;
+    int v = (d + 2) % 3;
+    int sizeU = grid.size[u];
+    int sizeV = grid.size[v];
+
+    // material + 1 of the exposed face at (u, v) of the slice and its
+    // occlusion levels shifted by 16, 0 when none
+    std::vector<uint32_t> slice(sizeU * sizeV);
+
+    for (int s = sliceBegin; s < sliceEnd; s++) {
+        std::fill(slice.begin(), slice.end(), 0);
+
+        int p[3];
+        p[d] = s;
+        for (int i = 0; i < sizeU; i++) {
+            p[u] = i;
+            for (int j = 0; j < sizeV; j++) {
+                p[v] = j;
+                size_t word = (size_t)grid.rowIndex(p[0], p[1]) * grid.wordsPerRow + (p[2] >> 6);
+                if ((mask[word] >> (p[2] & 63)) & 1) {
+                    uint8_t levels = emitter.occlusion ? faceOcclusion(grid, p[0], p[1], p[2], f) : Unoccluded;
+                    slice[i * sizeV + j] = (grid.material(p[0], p[1], p[2]) + 1) | levels << 16;
+                }
+            }
+        }
 
-        if (!faceFlags)
-            continue;
+        for (int i = 0; i < sizeU; i++) {
+            for (int j = 0; j < sizeV;) {
+                uint32_t cell = slice[i * sizeV + j];
+                if (!cell) {
+                    j++;
+                    continue;
+                }
 
-        VoxelBuffer& voxelBuffer = voxelGroup[materialID];
-        std::vector<fvec3>& vertexes = voxelBuffer.vertexes;
-        std::vector<fvec3>& normals = voxelBuffer.normals;
-        std::vector<Face>& faces = voxelBuffer.faces;
+                int width = 1;
+                while (j + width < sizeV && slice[i * sizeV + j + width] == cell)
+                    width++;
+
+                int height = 1;
+                for (; i + height < sizeU; height++) {
+                    const uint32_t* next = &slice[(i + height) * sizeV + j];
+                    int k = 0;
+                    while (k < width && next[k] == cell)
+                        k++;
+                    if (k < width)
+                        break;
+                }
 
-        fvec3 voxelPosition((float)position[0], (float)position[1], (float)position[2]);
+                for (int h = 0; h < height; h++)
+                    std::fill(&slice[(i + h) * sizeV + j], &slice[(i + h) * sizeV + j + width], 0);
 
-        // insert all faces
-        for (int f = 0; f < 6; f++) {
-            if ((1 << f) & faceFlags) {
-                Face face = FacesVoxel[f];
+                fvec3 lo, hi;
+                lo[d] = hi[d] = (float)(grid.min[d] + s);
+                lo[u] = (float)(grid.min[u] + i);
+                hi[u] = (float)(grid.min[u] + i + height - 1);
+                lo[v] = (float)(grid.min[v] + j);
+                hi[v] = (float)(grid.min[v] + j + width - 1);
+                emitter.emit((cell & 0xffff) - 1, f, lo, hi, cell >> 16);
+                nbFaces++;
 
-                int vertexBaseIndex = vertexes.size();
-                fvec3 normal = NormalFace[f];
+                j += width;
+            }
+        }
+    }
+    return nbFaces;
+}
 
-                for (int j = 0; j < 4; j++) {
-                    fvec3 v = VertexesVoxel[face[j]];
-                    v += voxelPosition;
-                    vertexes.push_back(v);
-                    normals.push_back(normal);
-                }
+static int polygonizeUnit(QuadEmitter& emitter, const VoxelGrid& grid, const VoxelFaceMasks& faceMasks,
+                          const MeshUnit& unit)
+{
+    if (unit.direction < 0)
+        return polygonizeFaces(emitter, grid, faceMasks, unit.begin, unit.end);
+    return polygonizeGreedy(emitter, grid, faceMasks, unit.direction, unit.begin, unit.end);
+}
 
-                Face f(0, 1, 2, 3);
-                f += vertexBaseIndex;
-                faces.push_back(f);
-                nbFaces++;
+// Clears the faces of the voxels outside [keepMin, keepMax), they were only
+// there to hide the faces of their neighbours
+static void clearFacesOutside(VoxelFaceMasks& faceMasks, const VoxelGrid& grid, const ivec3& keepMin,
+                              const ivec3& keepMax)
+{
+    std::vector<uint64_t> zMask(grid.wordsPerRow, 0);
+    for (int z = std::max(keepMin[2], 0); z < std::min(keepMax[2], grid.size[2]); z++)
+        zMask[z >> 6] |= uint64_t(1) << (z & 63);
+
+    for (int x = 0; x < grid.size[0]; x++) {
+        for (int y = 0; y < grid.size[1]; y++) {
+            bool inside = x >= keepMin[0] && x < keepMax[0] && y >= keepMin[1] && y < keepMax[1];
+            size_t base = (size_t)grid.rowIndex(x, y) * grid.wordsPerRow;
+            for (int f = 0; f < 6; f++) {
+                for (int w = 0; w < grid.wordsPerRow; w++)
+                    faceMasks.masks[f][base + w] &= inside ? zMask[w] : 0;
             }
         }
     }
-    printf("Faces %d - Vertexes %d\n", nbFaces, nbFaces * 4);
 }
 
-void polygonize(std::vector<VoxelGroup>& groups, const VoxScene& voxScene)
+void polygonize(VoxelGroup& voxelGroup, const VoxModel& voxModel, const PolygonizeOptions& options)
 {
-    for (const VoxModel& voxelModel : voxScene.voxels) {
-        VoxelGroup group;
-        polygonize(group, voxelModel);
-        groups.push_back(group);
+    VoxelGrid grid;
+    grid.build(voxModel);
+    if (grid.empty())
+        return;
+    polygonize(voxelGroup, grid, ivec3(0, 0, 0), grid.size, options);
+}
+
+void polygonize(VoxelGroup& voxelGroup, const VoxelGrid& grid, const ivec3& keepMin, const ivec3& keepMax,
+                const PolygonizeOptions& options)
+{
+    if (grid.empty())
+        return;
+
+    ThreadPool* threadPool = options.threadPool;
+
+    // masks of a slab read the rows around it, so every slab is done before meshing
+    VoxelFaceMasks faceMasks;
+    allocateFaceMasks(faceMasks, grid);
+    int numSlabs = (grid.size[0] + SlabSize - 1) / SlabSize;
+    parallelFor(threadPool, numSlabs, [&](int i) {
+        computeFaceMasks(faceMasks, grid, i * SlabSize, std::min((i + 1) * SlabSize, grid.size[0]));
+    });
+
+    bool keepAll = true;
+    for (int axis = 0; axis < 3; axis++)
+        keepAll = keepAll && keepMin[axis] <= 0 && keepMax[axis] >= grid.size[axis];
+    if (!keepAll)
+        clearFacesOutside(faceMasks, grid, keepMin, keepMax);
+
+    std::vector<MeshUnit> units;
+    if (options.greedy) {
+        for (int f = 0; f < 6; f++) {
+            int size = grid.size[f % 3];
+            for (int begin = 0; begin < size; begin += SlabSize) {
+                MeshUnit unit = {f, begin, std::min(begin + SlabSize, size)};
+                units.push_back(unit);
+            }
+        }
+    } else {
+        for (int begin = 0; begin < grid.size[0]; begin += SlabSize) {
+            MeshUnit unit = {-1, begin, std::min(begin + SlabSize, grid.size[0])};
+            units.push_back(unit);
+        }
     }
+
+    QuadEmitter emitter(voxelGroup, options);
+    if (threadPool && threadPool->size() > 1 && units.size() > 1) {
+        // slabs are meshed apart then stitched in order, faces on their
+        // boundaries come from the masks so only corners need welding
+        std::vector<VoxelGroup> parts(units.size());
+        threadPool->parallelFor(units.size(), [&](int i) {
+            QuadEmitter partEmitter(parts[i], options);
+            polygonizeUnit(partEmitter, grid, faceMasks, units[i]);
+        });
+
+        for (size_t i = 0; i < parts.size(); i++) {
+            emitter.append(parts[i]);
+            VoxelGroup().swap(parts[i]);
+        }
+    } else {
+        for (const MeshUnit& unit : units)
+            polygonizeUnit(emitter, grid, faceMasks, unit);
+    }
+}
+
+void polygonize(std::vector<VoxelGroup>& groups, const VoxScene& voxScene, const PolygonizeOptions& options)
+{
+    // models are independent, each one is meshed into its own slot
+    size_t first = groups.size();
+    groups.resize(first + voxScene.voxels.size());
+    parallelFor(options.threadPool, voxScene.voxels.size(),
+                [&](int i) { polygonize(groups[first + i], voxScene.voxels[i], options); });
 }
 
 // void createBruteForce(VoxelScene &scene, const VoxelList &voxelList) {
@@ -193,64 +617,3 @@ void polygonize(std::vector<VoxelGroup>& groups, const VoxScene& voxScene)
 //     }
 //   }
 // }
-
-int writeOBJ(const VoxelGroup& group, const char* path)
-{
-    FILE* fp = fopen(path, "w");
-
-    std::vector<int> vertexesOffset;
-    vertexesOffset.push_back(0);
-    int totalFaces = 0;
-
-    bool hasNormal = false;
-
-    for (VoxelGroup::const_iterator it = group.begin(); it != group.end(); it++) {
-        const std::vector<fvec3>& vertexes = it->second.vertexes;
-        const std::vector<Face>& faces = it->second.faces;
-        if (it->second.normals.size())
-            hasNormal = true;
-        for (unsigned int i = 0; i < vertexes.size(); i++) {
-            fprintf(fp, "v %f %f %f\n", vertexes[i][0], vertexes[i][1], vertexes[i][2]);
-        }
-
-        vertexesOffset.push_back(vertexes.size());
-        totalFaces += faces.size();
-    }
-
-    if (hasNormal) {
-        for (VoxelGroup::const_iterator it = group.begin(); it != group.end(); it++) {
-            const std::vector<fvec3>& normals = it->second.normals;
-            for (unsigned int i = 0; i < normals.size(); i++) {
-                fprintf(fp, "vn %f %f %f\n", normals[i][0], normals[i][1], normals[i][2]);
-            }
-        }
-    }
-
-    int indexGroup = 0;
-    fprintf(fp, "\n//Faces %d\n", totalFaces);
-    for (VoxelGroup::const_iterator it = group.begin(); it != group.end(); it++) {
-        int vertexOffset = vertexesOffset[indexGroup] + 1;
-
-        const std::vector<Face>& faces = it->second.faces;
-        fprintf(fp, "g material_%d\n", indexGroup);
-
-        if (hasNormal) {
-            for (unsigned int i = 0; i < faces.size(); i++) {
-                int v0 = vertexOffset + faces[i][0];
-                int v1 = vertexOffset + faces[i][1];
-                int v2 = vertexOffset + faces[i][2];
-                int v3 = vertexOffset + faces[i][3];
-                fprintf(fp, "f %d//%d %d//%d %d//%d %d//%d\n", v0, v0, v1, v1, v2, v2, v3, v3);
-            }
-        } else {
-            for (unsigned int i = 0; i < faces.size(); i++) {
-                fprintf(fp, "f %d %d %d %d\n", vertexOffset + faces[i][0], vertexOffset + faces[i][1],
-                        vertexOffset + faces[i][2], vertexOffset + faces[i][3]);
-            }
-        }
-        indexGroup++;
-    }
-
-    fclose(fp);
-    return 0;
-}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "VoxReader.h"
+
 #include <map>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <vector>
@@ -30,10 +33,18 @@ struct vec3 {
 typedef vec3<float> fvec3;
 typedef vec3<uint8_t> ucvec3;
 typedef vec3<int> ivec3;
+typedef vec3<int16_t> svec3;
 typedef uint8_t MaterialID;
 
+extern fvec3 NormalFace[6];
+// brightness of each ambient occlusion level, from 0 the darkest to 3
+extern const float OcclusionLight[4];
+
 struct Face {
     int v[4];
+    Face()
+        : v{0, 0, 0, 0}
+    {}
     Face(int x, int y, int z, int w)
         : v{x, y, z, w}
     {}
@@ -54,11 +65,96 @@ struct VoxelBuffer {
     std::vector<fvec3> vertexes;
     std::vector<fvec3> normals;
     std::vector<Face> faces;
+    // welded buffers have no per vertex normals, each face stores its direction instead
+    std::vector<uint8_t> faceNormals;
+    // atlas buffers hold every material, each face stores its own
+    std::vector<MaterialID> faceMaterials;
+    // ambient occlusion level of each vertex when computed, see OcclusionLight
+    std::vector<uint8_t> occlusion;
+
+    // Compact storage, used instead of vertexes, normals and faces when set.
+    // Corners are on the integer lattice, position + 0.5, and quads index them
+    // with 16 bits while the buffer has at most 65536 corners. Every face keeps
+    // its direction in faceNormals, unwelded buffers have the 4 corners of each
+    // face in order and take their normal from it.
+    bool compact = false;
+    bool welded = false;
+    std::vector<svec3> corners;
+    std::vector<uint16_t> quads16;
+    std::vector<uint32_t> quads32;
+
+    // accessors reading both storages, the writers go through them
+    inline size_t numVertexes() const { return compact ? corners.size() : vertexes.size(); }
+    inline size_t numFaces() const { return compact ? faceNormals.size() : faces.size(); }
+    inline bool hasVertexNormals() const { return compact ? !welded && !corners.empty() : !normals.empty(); }
+    inline bool hasFaceNormals() const { return (!compact || welded) && !faceNormals.empty(); }
+    inline bool hasFaceMaterials() const { return !faceMaterials.empty(); }
+    inline bool hasOcclusion() const { return !occlusion.empty(); }
+
+    inline fvec3 vertex(size_t i) const
+    {
+        if (!compact)
+            return vertexes[i];
+        const svec3& corner = corners[i];
+        return fvec3(corner[0] - 0.5f, corner[1] - 0.5f, corner[2] - 0.5f);
+    }
+    inline fvec3 vertexNormal(size_t i) const { return compact ? NormalFace[faceNormals[i / 4]] : normals[i]; }
+    inline Face face(size_t i) const
+    {
+        if (!compact)
+            return faces[i];
+        if (corners.size() > 65536)
+            return Face(quads32[i * 4], quads32[i * 4 + 1], quads32[i * 4 + 2], quads32[i * 4 + 3]);
+        return Face(quads16[i * 4], quads16[i * 4 + 1], quads16[i * 4 + 2], quads16[i * 4 + 3]);
+    }
+
+    // append to the compact storage, the quads move to 32 bits past 65536 corners
+    void addCorner(const svec3& corner);
+    void addQuad(const Face& quad, uint8_t direction);
+    // moves a compact buffer to the float storage, the same mesh, for
+    // positions that do not fit in 16 bits
+    void expand();
+    // moves the mesh by offset, a compact buffer is expanded first when a
+    // moved corner would not fit in 16 bits
+    void translate(const ivec3& offset);
 };
 
 typedef std::map<MaterialID, VoxelBuffer> VoxelGroup;
 
-struct VoxScene;
+class MeshCache;
+class Stats;
+class ThreadPool;
+struct VoxelGrid;
+
+struct PolygonizeOptions {
+    // merge coplanar faces of the same material into maximal rectangles
+    bool greedy = false;
+    // share corners between faces of a material, normals are stored per face
+    bool weld = false;
+    // store meshes in the compact VoxelBuffer storage
+    bool compact = false;
+    // put every material in the buffer of material 0, with a material per
+    // face, for output textured by the palette
+    bool atlas = false;
+    // Ambient occlusion per vertex from the 3 voxels around each corner in
+    // front of the face. Faces and vertexes are only merged when their
+    // occlusion matches and quads are split along their brighter diagonal.
+    bool occlusion = false;
+    // mesh models and slabs of large models in parallel when set
+    ThreadPool* threadPool = nullptr;
+    // meshes of models are loaded from and stored to the cache when set
+    MeshCache* cache = nullptr;
+    // per stage timings and per model counts are added when set
+    Stats* stats = nullptr;
+};
 
-void polygonize(std::vector<VoxelGroup>& groups, const VoxScene& voxScene);
-int writeOBJ(const VoxelGroup& group, const char* path);
+void polygonize(VoxelGroup& voxelGroup, const VoxModel& voxModel, const PolygonizeOptions& options = PolygonizeOptions());
+// Meshes the voxels of a grid built by the caller whose grid coordinates are in
+// [keepMin, keepMax). The voxels outside only hide the faces they touch.
+void polygonize(VoxelGroup& voxelGroup, const VoxelGrid& grid, const ivec3& keepMin, const ivec3& keepMax,
+                const PolygonizeOptions& options = PolygonizeOptions());
+void polygonize(std::vector<VoxelGroup>& groups, const VoxScene& voxScene,
+                const PolygonizeOptions& options = PolygonizeOptions());
+// threadPool formats parts of the file in parallel when set
+int writeOBJ(const VoxelGroup& group, const char* path, ThreadPool* threadPool = nullptr);
+int writeGLB(const VoxelGroup& group, const char* path);
@@ -0,0 +1,566 @@
+#include "Json.h"
+#include "Log.h"
+#include "MeshWriter.h"
+#include "Triangles.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdarg.h>
+#include <string>
+#include <strings.h>
+
+// glTF constants
+static const int ARRAY_BUFFER = 34962;
+static const int ELEMENT_ARRAY_BUFFER = 34963;
+static const int UNSIGNED_BYTE = 5121;
+static const int UNSIGNED_SHORT = 5123;
+static const int UNSIGNED_INT = 5125;
+static const int FLOAT = 5126;
+static const int NEAREST = 9728;
+
+static const uint32_t GLB_MAGIC = 0x46546C67;      // "glTF"
+static const uint32_t GLB_CHUNK_JSON = 0x4E4F534A; // "JSON"
+static const uint32_t GLB_CHUNK_BIN = 0x004E4942;  // "BIN\0"
+
+static void appendf(std::string& str, const char* format, ...)
+{
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (size < (int)sizeof(buffer)) {
+        str.append(buffer, size);
+        return;
+    }
+
+    std::vector<char> large(size + 1);
+    va_start(args, format);
+    vsnprintf(&large[0], large.size(), format, args);
+    va_end(args);
+    str.append(&large[0], size);
+}
+
+static inline uint32_t align4(uint32_t size) { return (size + 3) & ~3u; }
+
+// Quads are split along their 0-2 diagonal, keeping the winding, unless the
+// buffer went through an optimized triangle list
+template <typename T>
+static void triangleIndexes(std::vector<T>& indexes, const VoxelBuffer& buffer, const TriangleList* triangles)
+{
+    if (triangles) {
+        indexes.assign(triangles->indexes.begin(), triangles->indexes.end());
+        return;
+    }
+
+    indexes.reserve(buffer.numFaces() * 6);
+    for (size_t i = 0; i < buffer.numFaces(); i++) {
+        Face face = buffer.face(i);
+        indexes.push_back(face[0]);
+        indexes.push_back(face[1]);
+        indexes.push_back(face[2]);
+        indexes.push_back(face[0]);
+        indexes.push_back(face[2]);
+        indexes.push_back(face[3]);
+    }
+}
+
+// Meshes are added to the binary buffer as they come, which is spooled to a
+// temporary file since the JSON chunk preceding it is only known at the end.
+// Writing to memory, it goes straight to the output buffer and the header and
+// JSON chunk are inserted before it on close.
+// Meshes written with write get their own node, those added with addMesh are
+// placed by instances. Materials are shared between meshes. With a palette,
+// atlas buffers get texture coordinates into the palette image, embedded in
+// the binary buffer on close. Animation frames are nodes parenting what is
+// written during the frame, scaled to 0 outside of it by a STEP animation.
+class GLBWriter : public MeshWriter {
+
+  public:
+    // optimize reorders triangles and vertexes for the vertex cache
+    explicit GLBWriter(bool optimize)
+        : _optimize(optimize)
+    {}
+    ~GLBWriter() { close(); }
+
+    bool open(const char* path);
+    bool open(OutputBuffer& buffer);
+    bool write(const VoxelGroup& group, const std::string& name);
+    bool close();
+
+    bool supportsInstancing() const { return true; }
+    int addMesh(const VoxelGroup& group, const std::string& name);
+    bool addInstance(int mesh, const float* matrix, const std::string& name);
+
+    bool supportsAnimation() const { return true; }
+    void beginFrame(const std::string& name, float start, float end);
+
+    void setPalette(const Palette& palette)
+    {
+        _palette = palette;
+        _hasPalette = true;
+    }
+
+  private:
+    bool isOpen() const { return _spool || _buffer; }
+    void start();
+    // a target of 0 is left out, for views that are not vertex data
+    int addView(const void* data, uint32_t size, int target);
+    int addAccessor(int view, int componentType, uint32_t count, const char* type, const std::string& extra);
+    // child of the current frame, a root before any frame
+    void addNode(const std::string& node);
+    // appends the frame nodes and returns the animation showing them
+    std::string addAnimation();
+
+    struct Frame {
+        std::string name;
+        float start;
+        float end;
+        std::vector<int> children;
+    };
+
+    bool _optimize;
+    std::string _path;
+    FILE* _spool = nullptr;
+    OutputBuffer* _buffer = nullptr;
+    // size of the buffer before the glb
+    size_t _binStart = 0;
+    bool _failed = false;
+    uint32_t _binSize = 0;
+    int _numViews = 0;
+    int _numAccessors = 0;
+    std::string _bufferViews;
+    std::string _accessors;
+    std::vector<std::string> _meshes;
+    std::vector<std::string> _nodes;
+    std::vector<int> _roots;
+    std::vector<Frame> _frames;
+    // material of each glTF material, PaletteMaterial for the textured one
+    std::vector<int> _materials;
+    Palette _palette;
+    bool _hasPalette = false;
+};
+
+static const int PaletteMaterial = -1;
+
+bool GLBWriter::open(const char* path)
+{
+    close();
+    _spool = tmpfile();
+    if (!_spool) {
+        logMessage(LOG_ERROR, "Failed to create a temporary file for %s\n", path);
+        return false;
+    }
+
+    _path = path;
+    start();
+    return true;
+}
+
+bool GLBWriter::open(OutputBuffer& buffer)
+{
+    close();
+    _buffer = &buffer;
+    _binStart = buffer.size;
+    start();
+    return true;
+}
+
+void GLBWriter::start()
+{
+    _failed = false;
+    _binSize = 0;
+    _numViews = _numAccessors = 0;
+    _bufferViews.clear();
+    _accessors.clear();
+    _meshes.clear();
+    _nodes.clear();
+    _roots.clear();
+    _frames.clear();
+    _materials.clear();
+}
+
+int GLBWriter::addView(const void* data, uint32_t size, int target)
+{
+    static const uint8_t padding[4] = {0, 0, 0, 0};
+    if (_buffer) {
+        if (!_buffer->append(data, size) || !_buffer->append(padding, align4(size) - size))
+            _failed = true;
+    } else {
+        fwrite(data, size, 1, _spool);
+        if (align4(size) != size)
+            fwrite(padding, align4(size) - size, 1, _spool);
+    }
+
+    appendf(_bufferViews, "%s{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u", _numViews ? "," : "", _binSize,
+            size);
+    if (target)
+        appendf(_bufferViews, ",\"target\":%d", target);
+    _bufferViews += "}";
+    _binSize += align4(size);
+    return _numViews++;
+}
+
+int GLBWriter::addAccessor(int view, int componentType, uint32_t count, const char* type, const std::string& extra)
+{
+    appendf(_accessors, "%s{\"bufferView\":%d,\"componentType\":%d,\"count\":%u,\"type\":\"%s\"",
+            _numAccessors ? "," : "", view, componentType, count, type);
+    _accessors += extra + "}";
+    return _numAccessors++;
+}
+
+static std::string nameProperty(const std::string& name)
+{
+    return name.empty() ? std::string() : "\"name\":\"" + escapeJSON(name) + "\",";
+}
+
+int GLBWriter::addMesh(const VoxelGroup& group, const std::string& name)
+{
+    if (!isOpen())
+        return -1;
+
+    std::string primitives;
+    for (VoxelGroup::const_iterator it = group.begin(); it != group.end(); it++) {
+        const VoxelBuffer& buffer = it->second;
+        if (!buffer.numFaces())
+            continue;
+
+        TriangleList triangleList;
+        const TriangleList* triangles = nullptr;
+        if (_optimize) {
+            triangulate(triangleList, buffer, true);
+            triangles = &triangleList;
+        }
+
+        // compact buffers and reordered vertexes are expanded to the float attributes of glTF
+        bool expand = buffer.compact || triangles;
+        std::vector<fvec3> expanded;
+        if (expand) {
+            expanded.resize(triangles ? triangles->vertexes.size() : buffer.numVertexes());
+            for (size_t i = 0; i < expanded.size(); i++)
+                expanded[i] = buffer.vertex(triangles ? triangles->vertexes[i] : i);
+        }
+        const std::vector<fvec3>& vertexes = expand ? expanded : buffer.vertexes;
+
+        fvec3 min = vertexes[0];
+        fvec3 max = vertexes[0];
+        for (const fvec3& v : vertexes) {
+            for (int axis = 0; axis < 3; axis++) {
+                min[axis] = v[axis] < min[axis] ? v[axis] : min[axis];
+                max[axis] = v[axis] > max[axis] ? v[axis] : max[axis];
+            }
+        }
+
+        std::string bounds;
+        appendf(bounds, ",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]", min[0], min[1], min[2], max[0], max[1],
+                max[2]);
+        int view = addView(&vertexes[0], vertexes.size() * sizeof(fvec3), ARRAY_BUFFER);
+        int position = addAccessor(view, FLOAT, vertexes.size(), "VEC3", bounds);
+        appendf(primitives, "%s{\"attributes\":{\"POSITION\":%d", primitives.empty() ? "" : ",", position);
+
+        // welded buffers have no vertex normals, glTF viewers then compute flat normals
+        if (buffer.hasVertexNormals()) {
+            if (expand) {
+                for (size_t i = 0; i < expanded.size(); i++)
+                    expanded[i] = buffer.vertexNormal(triangles ? triangles->vertexes[i] : i);
+            }
+            const std::vector<fvec3>& normals = expand ? expanded : buffer.normals;
+            view = addView(&normals[0], normals.size() * sizeof(fvec3), ARRAY_BUFFER);
+            appendf(primitives, ",\"NORMAL\":%d", addAccessor(view, FLOAT, normals.size(), "VEC3", std::string()));
+        }
+
+        // occlusion is a gray vertex color, multiplying the base color of the material
+        if (buffer.hasOcclusion()) {
+            std::vector<uint8_t> colors(vertexes.size() * 4, 255);
+            for (size_t i = 0; i < vertexes.size(); i++) {
+                uint8_t level = buffer.occlusion[triangles ? triangles->vertexes[i] : i];
+                uint8_t light = (uint8_t)(OcclusionLight[level] * 255.0f + 0.5f);
+                colors[i * 4] = colors[i * 4 + 1] = colors[i * 4 + 2] = light;
+            }
+            view = addView(&colors[0], colors.size(), ARRAY_BUFFER);
+            appendf(primitives, ",\"COLOR_0\":%d",
+                    addAccessor(view, UNSIGNED_BYTE, vertexes.size(), "VEC4", ",\"normalized\":true"));
+        }
+
+        // vertexes of an atlas buffer are only shared by faces of the same material
+        bool textured = _hasPalette && buffer.hasFaceMaterials();
+        if (textured) {
+            std::vector<float> uvs(vertexes.size() * 2, PaletteV);
+            size_t numFaces = triangles ? triangles->faces.size() : buffer.numFaces();
+            for (size_t i = 0; i < numFaces; i++) {
+                float u = paletteU(buffer.faceMaterials[triangles ? triangles->faces[i] : i]);
+                if (triangles) {
+                    for (int j = 0; j < 3; j++)
+                        uvs[triangles->indexes[i * 3 + j] * 2] = u;
+                } else {
+                    Face face = buffer.face(i);
+                    for (int j = 0; j < 4; j++)
+                        uvs[face[j] * 2] = u;
+                }
+            }
+            view = addView(&uvs[0], uvs.size() * sizeof(float), ARRAY_BUFFER);
+            appendf(primitives, ",\"TEXCOORD_0\":%d", addAccessor(view, FLOAT, vertexes.size(), "VEC2", std::string()));
+        }
+
+        int indexes;
+        if (vertexes.size() < 65536) {
+            std::vector<uint16_t> indexes16;
+            triangleIndexes(indexes16, buffer, triangles);
+            view = addView(&indexes16[0], indexes16.size() * sizeof(uint16_t), ELEMENT_ARRAY_BUFFER);
+            indexes = addAccessor(view, UNSIGNED_SHORT, indexes16.size(), "SCALAR", std::string());
+        } else {
+            std::vector<uint32_t> indexes32;
+            triangleIndexes(indexes32, buffer, triangles);
+            view = addView(&indexes32[0], indexes32.size() * sizeof(uint32_t), ELEMENT_ARRAY_BUFFER);
+            indexes = addAccessor(view, UNSIGNED_INT, indexes32.size(), "SCALAR", std::string());
+        }
+
+        int id = textured ? PaletteMaterial : it->first;
+        int material = 0;
+        while (material < (int)_materials.size() && _materials[material] != id)
+            material++;
+        if (material == (int)_materials.size())
+            _materials.push_back(id);
+
+        appendf(primitives, "},\"indices\":%d,\"material\":%d,\"mode\":4}", indexes, material);
+    }
+
+    if (_spool && ferror(_spool))
+        _failed = true;
+
+    // glTF meshes need at least one primitive
+    if (primitives.empty())
+        return -1;
+
+    _meshes.push_back("{" + nameProperty(name) + "\"primitives\":[" + primitives + "]}");
+    return (int)_meshes.size() - 1;
+}
+
+bool GLBWriter::write(const VoxelGroup& group, const std::string& name)
+{
+    if (!isOpen())
+        return false;
+
+    int mesh = addMesh(group, name);
+    if (mesh >= 0) {
+        std::string node;
+        appendf(node, "{%s\"mesh\":%d}", nameProperty(name).c_str(), mesh);
+        addNode(node);
+    }
+    return !_failed;
+}
+
+bool GLBWriter::addInstance(int mesh, const float* matrix, const std::string& name)
+{
+    if (!isOpen() || mesh < 0 || mesh >= (int)_meshes.size())
+        return false;
+
+    std::string node;
+    appendf(node, "{%s\"mesh\":%d,\"matrix\":[", nameProperty(name).c_str(), mesh);
+    for (int i = 0; i < 16; i++)
+        appendf(node, "%s%.9g", i ? "," : "", matrix[i]);
+    node += "]}";
+    addNode(node);
+    return !_failed;
+}
+
+void GLBWriter::addNode(const std::string& node)
+{
+    if (_frames.empty()) {
+        _roots.push_back(_nodes.size());
+    } else {
+        _frames.back().children.push_back(_nodes.size());
+    }
+    _nodes.push_back(node);
+}
+
+void GLBWriter::beginFrame(const std::string& name, float start, float end)
+{
+    Frame frame;
+    frame.name = name;
+    frame.start = start;
+    frame.end = end;
+    _frames.push_back(frame);
+}
+
+std::string GLBWriter::addAnimation()
+{
+    float duration = 0;
+    for (const Frame& frame : _frames)
+        duration = std::max(duration, frame.end);
+
+    // the scale of a frame node is 0 but from its start to its end, without
+    // playing the animation the nodes at time 0 are shown
+    std::string samplers;
+    std::string channels;
+    for (size_t i = 0; i < _frames.size(); i++) {
+        const Frame& frame = _frames[i];
+        std::vector<float> times;
+        std::vector<float> scales;
+        if (frame.start > 0) {
+            times.push_back(0);
+            scales.push_back(0);
+        }
+        times.push_back(frame.start);
+        scales.push_back(1);
+        if (frame.end < duration) {
+            times.push_back(frame.end);
+            scales.push_back(0);
+        }
+
+        std::vector<float> scaleVectors;
+        for (float scale : scales)
+            scaleVectors.insert(scaleVectors.end(), 3, scale);
+        std::string bounds;
+        appendf(bounds, ",\"min\":[%.9g],\"max\":[%.9g]", times.front(), times.back());
+        int input = addAccessor(addView(&times[0], times.size() * 4, 0), FLOAT, times.size(), "SCALAR", bounds);
+        int output = addAccessor(addView(&scaleVectors[0], scaleVectors.size() * 4, 0), FLOAT, scales.size(), "VEC3",
+                                 std::string());
+        appendf(samplers, "%s{\"input\":%d,\"output\":%d,\"interpolation\":\"STEP\"}", i ? "," : "", input, output);
+        appendf(channels, "%s{\"sampler\":%d,\"target\":{\"node\":%d,\"path\":\"scale\"}}", i ? "," : "", (int)i,
+                (int)_nodes.size());
+
+        std::string node = "{" + nameProperty(frame.name);
+        if (!frame.children.empty()) {
+            node += "\"children\":[";
+            for (size_t c = 0; c < frame.children.size(); c++)
+                appendf(node, "%s%d", c ? "," : "", frame.children[c]);
+            node += "],";
+        }
+        float scale = frame.start > 0 ? 0 : 1;
+        appendf(node, "\"scale\":[%g,%g,%g]}", scale, scale, scale);
+        _roots.push_back(_nodes.size());
+        _nodes.push_back(node);
+    }
+    return "\"animations\":[{\"name\":\"frames\",\"samplers\":[" + samplers + "],\"channels\":[" + channels + "]}],";
+}
+
+bool GLBWriter::close()
+{
+    if (!isOpen())
+        return !_failed;
+
+    std::string animation;
+    if (!_frames.empty() && !_meshes.empty())
+        animation = addAnimation();
+
+    // the palette image goes at the end of the binary buffer
+    int image = -1;
+    for (int id : _materials) {
+        if (id == PaletteMaterial) {
+            std::vector<uint8_t> png;
+            encodePNG(png, &_palette.colors[0][0], 256, 1);
+            image = addView(&png[0], png.size(), 0);
+        }
+    }
+
+    std::string json;
+    json += "{\"asset\":{\"version\":\"2.0\",\"generator\":\"vox2obj\"},\"scene\":0,";
+    if (_meshes.empty()) {
+        json += "\"scenes\":[{\"nodes\":[]}]}";
+    } else {
+        json += "\"scenes\":[{\"nodes\":[";
+        for (size_t i = 0; i < _roots.size(); i++)
+            appendf(json, "%s%d", i ? "," : "", _roots[i]);
+        json += "]}]," + animation + "\"nodes\":[";
+        for (size_t i = 0; i < _nodes.size(); i++)
+            json += (i ? "," : "") + _nodes[i];
+        json += "],\"meshes\":[";
+        for (size_t i = 0; i < _meshes.size(); i++)
+            json += (i ? "," : "") + _meshes[i];
+        json += "],\"materials\":[";
+        for (size_t i = 0; i < _materials.size(); i++) {
+            if (_materials[i] == PaletteMaterial) {
+                appendf(json, "%s{\"name\":\"palette\",\"pbrMetallicRoughness\":{\"baseColorTexture\":{\"index\":0},"
+                              "\"metallicFactor\":0}}",
+                        i ? "," : "");
+            } else {
+                appendf(json, "%s{\"name\":\"material_%d\"}", i ? "," : "", _materials[i]);
+            }
+        }
+        if (image >= 0) {
+            // nearest filtering keeps each material a flat color
+            appendf(json,
+                    "],\"images\":[{\"bufferView\":%d,\"mimeType\":\"image/png\"}],\"samplers\":[{\"magFilter\":%d,"
+                    "\"minFilter\":%d}],\"textures\":[{\"sampler\":0,\"source\":0}",
+                    image, NEAREST, NEAREST);
+        }
+        json += "],\"accessors\":[" + _accessors + "],\"bufferViews\":[" + _bufferViews + "],";
+        appendf(json, "\"buffers\":[{\"byteLength\":%u}]}", _binSize);
+    }
+
+    // JSON chunk is padded with spaces, BIN chunk with zeros
+    json.append(align4(json.size()) - json.size(), ' ');
+
+    uint32_t totalSize = 12 + 8 + json.size() + (_binSize ? 8 + _binSize : 0);
+    uint32_t header[5] = {GLB_MAGIC, 2, totalSize, (uint32_t)json.size(), GLB_CHUNK_JSON};
+    uint32_t binHeader[2] = {_binSize, GLB_CHUNK_BIN};
+    size_t binHeaderSize = _binSize ? sizeof(binHeader) : 0;
+
+    if (_buffer) {
+        OutputBuffer& buffer = *_buffer;
+        _buffer = nullptr;
+        size_t prefix = sizeof(header) + json.size() + binHeaderSize;
+        if (_failed || !buffer.reserve(prefix)) {
+            buffer.size = _binStart;
+            _failed = true;
+            return false;
+        }
+        uint8_t* glb = buffer.data + _binStart;
+        memmove(glb + prefix, glb, buffer.size - _binStart);
+        memcpy(glb, header, sizeof(header));
+        memcpy(glb + sizeof(header), json.data(), json.size());
+        memcpy(glb + sizeof(header) + json.size(), binHeader, binHeaderSize);
+        buffer.size += prefix;
+        return true;
+    }
+
+    Output output;
+    if (!output.open(_path.c_str(), true)) {
+        logMessage(LOG_ERROR, "Failed to open %s\n", _path.c_str());
+        fclose(_spool);
+        _spool = nullptr;
+        _failed = true;
+        return false;
+    }
+
+    output.write(header, sizeof(header));
+    output.write(json.data(), json.size());
+    if (_binSize) {
+        output.write(binHeader, sizeof(binHeader));
+
+        std::vector<uint8_t> block(1 << 20);
+        fseek(_spool, 0, SEEK_SET);
+        size_t read;
+        while ((read = fread(&block[0], 1, block.size(), _spool)) > 0)
+            output.write(&block[0], read);
+    }
+
+    if (ferror(_spool))
+        _failed = true;
+    fclose(_spool);
+    _spool = nullptr;
+    if (!output.close())
+        _failed = true;
+    return !_failed;
+}
+
+MeshWriter* createGLBWriter(bool optimize) { return new GLBWriter(optimize); }
+
+MeshWriter* createMeshWriter(const char* path, ThreadPool* threadPool, bool triangles)
+{
+    size_t length = strlen(path);
+    if ((length >= 4 && strcasecmp(path + length - 4, ".glb") == 0) || strcasecmp(path, "glb") == 0)
+        return createGLBWriter(triangles);
+    return createOBJWriter(threadPool, triangles);
+}
+
+int writeGLB(const VoxelGroup& group, const char* path)
+{
+    GLBWriter writer(false);
+    if (!writer.open(path))
+        return 1;
+
+    bool written = writer.write(group, std::string());
+    return writer.close() && written ? 0 : 1;
+}
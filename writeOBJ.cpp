@@ -0,0 +1,501 @@
+#include "Log.h"
+#include "MeshWriter.h"
+#include "ThreadPool.h"
+#include "Triangles.h"
+
+#include <cstring>
+#include <math.h>
+#include <string>
+
+// Lines are formatted in blocks that can be done on separate threads, a window
+// of blocks is formatted then written in order before the next one.
+static const size_t LinesPerBlock = 1 << 14;
+static const int BlocksPerThread = 4;
+
+// Writes what printf("%f") prints for value. Voxel coordinates and normals are
+// multiples of 0.5 and take the fast path, anything else goes to snprintf.
+static inline char* formatFloat(char* out, float value)
+{
+    float absolute = fabsf(value);
+    float twice = absolute * 2.0f;
+    if (absolute < 1e9f && twice == (float)(uint32_t)twice) {
+        if (signbit(value))
+            *out++ = '-';
+
+        uint32_t integer = (uint32_t)absolute;
+        char digits[10];
+        int count = 0;
+        do {
+            digits[count++] = '0' + integer % 10;
+            integer /= 10;
+        } while (integer);
+        while (count)
+            *out++ = digits[--count];
+
+        memcpy(out, ((uint32_t)twice & 1) ? ".500000" : ".000000", 7);
+        return out + 7;
+    }
+    return out + snprintf(out, 64, "%f", value);
+}
+
+static inline char* formatInt(char* out, int value)
+{
+    uint32_t integer = value;
+    if (value < 0) {
+        *out++ = '-';
+        integer = -(uint32_t)value;
+    }
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = '0' + integer % 10;
+        integer /= 10;
+    } while (integer);
+    while (count)
+        *out++ = digits[--count];
+    return out;
+}
+
+static inline char* formatVec3(char* out, const char* prefix, const fvec3& v)
+{
+    while (*prefix)
+        *out++ = *prefix++;
+    out = formatFloat(out, v[0]);
+    *out++ = ' ';
+    out = formatFloat(out, v[1]);
+    *out++ = ' ';
+    out = formatFloat(out, v[2]);
+    *out++ = '\n';
+    return out;
+}
+
+// " r g b" of each occlusion level, vertexes with occlusion get their color
+// after their position
+struct OcclusionColors {
+    char text[4][64];
+    size_t size[4];
+
+    OcclusionColors()
+    {
+        for (int level = 0; level < 4; level++) {
+            float light = OcclusionLight[level];
+            size[level] = snprintf(text[level], sizeof(text[level]), " %f %f %f", light, light, light);
+        }
+    }
+};
+
+static const OcclusionColors& occlusionColors()
+{
+    static OcclusionColors colors;
+    return colors;
+}
+
+// A part of the file: a range of lines of one VoxelBuffer, or plain text. In
+// triangle mode lines follow the order of the triangle list of the buffer.
+struct TextBlock {
+    enum Type { TEXT, VERTEXES, NORMALS, FACES, FACES_NORMAL, FACES_FACE_NORMAL };
+
+    Type type;
+    const VoxelBuffer* buffer;
+    const TriangleList* triangles;
+    size_t begin;
+    size_t end;
+    int vertexOffset;
+    int normalOffset;
+    // index of the palette texture coordinate of material 0, -1 without
+    int uvOffset;
+    std::string text;
+};
+
+// worst case length of a line: 3 floats going through snprintf and a color
+static const size_t MaxLineSize = 3 * 64 + 64 + 8;
+// usual length of a line, used to size the block text up front
+static const size_t LineSizeHint = 32;
+
+// Make room for one more line after cursor, returns the new cursor
+static inline char* reserveLine(std::string& out, char* cursor)
+{
+    size_t used = cursor - &out[0];
+    if (out.size() - used < MaxLineSize)
+        out.resize(out.size() * 2 + MaxLineSize);
+    return &out[0] + used;
+}
+
+static void formatBlock(std::string& out, const TextBlock& block)
+{
+    if (block.type == TextBlock::TEXT) {
+        out = block.text;
+        return;
+    }
+
+    out.resize((block.end - block.begin) * LineSizeHint + MaxLineSize);
+    char* cursor = &out[0];
+    const VoxelBuffer& buffer = *block.buffer;
+    const TriangleList* triangles = block.triangles;
+
+    switch (block.type) {
+    case TextBlock::VERTEXES:
+        for (size_t i = block.begin; i < block.end; i++) {
+            cursor = reserveLine(out, cursor);
+            size_t vertex = triangles ? triangles->vertexes[i] : i;
+            cursor = formatVec3(cursor, "v ", buffer.vertex(vertex));
+            if (buffer.hasOcclusion()) {
+                const OcclusionColors& colors = occlusionColors();
+                uint8_t level = buffer.occlusion[vertex];
+                memcpy(cursor - 1, colors.text[level], colors.size[level]);
+                cursor += colors.size[level] - 1;
+                *cursor++ = '\n';
+            }
+        }
+        break;
+    case TextBlock::NORMALS:
+        for (size_t i = block.begin; i < block.end; i++) {
+            cursor = reserveLine(out, cursor);
+            cursor = formatVec3(cursor, "vn ", buffer.vertexNormal(triangles ? triangles->vertexes[i] : i));
+        }
+        break;
+    default:
+        for (size_t i = block.begin; i < block.end; i++) {
+            cursor = reserveLine(out, cursor);
+            Face face;
+            int corners = 4;
+            size_t faceIndex = i;
+            if (triangles) {
+                const uint32_t* triangle = &triangles->indexes[i * 3];
+                face = Face(triangle[0], triangle[1], triangle[2], 0);
+                corners = 3;
+                faceIndex = triangles->faces[i];
+            } else {
+                face = buffer.face(i);
+            }
+            *cursor++ = 'f';
+            for (int j = 0; j < corners; j++) {
+                int v = block.vertexOffset + face[j];
+                *cursor++ = ' ';
+                cursor = formatInt(cursor, v);
+                if (block.uvOffset >= 0) {
+                    *cursor++ = '/';
+                    cursor = formatInt(cursor, block.uvOffset + buffer.faceMaterials[faceIndex]);
+                }
+                if (block.type != TextBlock::FACES && block.uvOffset < 0)
+                    *cursor++ = '/';
+                if (block.type == TextBlock::FACES_NORMAL) {
+                    *cursor++ = '/';
+                    cursor = formatInt(cursor, block.normalOffset + v);
+                } else if (block.type == TextBlock::FACES_FACE_NORMAL) {
+                    *cursor++ = '/';
+                    cursor = formatInt(cursor, block.normalOffset + buffer.faceNormals[faceIndex]);
+                }
+            }
+            *cursor++ = '\n';
+        }
+        break;
+    }
+    out.resize(cursor - &out[0]);
+}
+
+static void addText(std::vector<TextBlock>& blocks, const std::string& text)
+{
+    TextBlock block;
+    block.type = TextBlock::TEXT;
+    block.buffer = nullptr;
+    block.triangles = nullptr;
+    block.begin = block.end = 0;
+    block.vertexOffset = 0;
+    block.normalOffset = 0;
+    block.uvOffset = -1;
+    block.text = text;
+    blocks.push_back(block);
+}
+
+static void addRanges(std::vector<TextBlock>& blocks, TextBlock::Type type, const VoxelBuffer& buffer,
+                      const TriangleList* triangles, size_t count, int vertexOffset, int normalOffset,
+                      int uvOffset = -1)
+{
+    for (size_t begin = 0; begin < count; begin += LinesPerBlock) {
+        TextBlock block;
+        block.type = type;
+        block.buffer = &buffer;
+        block.triangles = triangles;
+        block.begin = begin;
+        block.end = begin + LinesPerBlock < count ? begin + LinesPerBlock : count;
+        block.vertexOffset = vertexOffset;
+        block.normalOffset = normalOffset;
+        block.uvOffset = uvOffset;
+        blocks.push_back(block);
+    }
+}
+
+// Each mesh is written as its vertexes, its normals then its faces grouped by
+// material. Indexes continue from the previous meshes of the file, vertexes
+// with occlusion get it as a gray color after their position. In
+// triangle mode quads are split and ordered for the vertex cache. With a
+// palette, atlas buffers use the palette material and a texture coordinate
+// per material, written once, and the .mtl and .png files are written next to
+// the obj on close.
+class OBJWriter : public MeshWriter {
+
+  public:
+    OBJWriter(ThreadPool* threadPool, bool triangles)
+        : _threadPool(threadPool)
+        , _triangles(triangles)
+    {}
+    ~OBJWriter() { close(); }
+
+    bool open(const char* path);
+    bool open(OutputBuffer& buffer);
+    bool write(const VoxelGroup& group, const std::string& name);
+    bool close();
+
+    void setPalette(const Palette& palette)
+    {
+        _palette = palette;
+        _hasPalette = true;
+    }
+
+  private:
+    void start(const char* path);
+    void writeBlocks(const std::vector<TextBlock>& blocks);
+
+    ThreadPool* _threadPool;
+    bool _triangles;
+    Output _output;
+    bool _failed = false;
+    int _vertexCount = 0;
+    int _normalCount = 0;
+    // index of the first of the 6 axis normals once written
+    int _axisNormals = -1;
+    std::vector<std::string> _texts;
+    Palette _palette;
+    bool _hasPalette = false;
+    // empty when writing to a buffer
+    std::string _path;
+    // index of the first of the 256 palette texture coordinates once written
+    int _paletteUVs = -1;
+};
+
+// path with its extension replaced by extension
+static std::string sidePath(const std::string& path, const char* extension)
+{
+    size_t dot = path.rfind('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = path.size();
+    return path.substr(0, dot) + extension;
+}
+
+static std::string baseName(const std::string& path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool OBJWriter::open(const char* path)
+{
+    close();
+    if (!_output.open(path, false)) {
+        logMessage(LOG_ERROR, "Failed to open %s\n", path);
+        return false;
+    }
+    start(path);
+    return true;
+}
+
+bool OBJWriter::open(OutputBuffer& buffer)
+{
+    close();
+    _output.open(buffer);
+    start("");
+    return true;
+}
+
+void OBJWriter::start(const char* path)
+{
+    _failed = false;
+    _vertexCount = _normalCount = 0;
+    _axisNormals = -1;
+    _paletteUVs = -1;
+    _path = path;
+    if (_hasPalette && !_path.empty()) {
+        std::string mtllib = "mtllib " + baseName(sidePath(_path, ".mtl")) + "\n";
+        _output.write(mtllib.data(), mtllib.size());
+    }
+}
+
+bool OBJWriter::write(const VoxelGroup& group, const std::string& name)
+{
+    if (!_output.isOpen())
+        return false;
+
+    std::vector<TextBlock> blocks;
+    // first vertex of each material buffer, the faces of a buffer index past
+    // the vertexes of every buffer written before it
+    std::vector<int> vertexesOffset;
+    vertexesOffset.push_back(_vertexCount);
+    int totalFaces = 0;
+
+    bool hasNormal = false;
+    bool hasFaceNormal = false;
+    bool hasAtlas = false;
+
+    if (!name.empty())
+        addText(blocks, "o " + name + "\n");
+
+    std::vector<const VoxelBuffer*> buffers;
+    for (VoxelGroup::const_iterator it = group.begin(); it != group.end(); it++)
+        buffers.push_back(&it->second);
+
+    std::vector<TriangleList> triangleLists(_triangles ? buffers.size() : 0);
+    if (_triangles && _threadPool) {
+        _threadPool->parallelFor(buffers.size(), [&](int i) { triangulate(triangleLists[i], *buffers[i], true); });
+    } else if (_triangles) {
+        for (size_t i = 0; i < buffers.size(); i++)
+            triangulate(triangleLists[i], *buffers[i], true);
+    }
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        const VoxelBuffer& buffer = *buffers[i];
+        const TriangleList* triangles = _triangles ? &triangleLists[i] : nullptr;
+        if (buffer.hasVertexNormals())
+            hasNormal = true;
+        if (buffer.hasFaceNormals())
+            hasFaceNormal = true;
+        if (buffer.hasFaceMaterials())
+            hasAtlas = true;
+        size_t numVertexes = triangles ? triangles->vertexes.size() : buffer.numVertexes();
+        addRanges(blocks, TextBlock::VERTEXES, buffer, triangles, numVertexes, 0, 0);
+
+        vertexesOffset.push_back(vertexesOffset.back() + numVertexes);
+        totalFaces += triangles ? triangles->faces.size() : buffer.numFaces();
+    }
+
+    // per vertex normals are written in the same order as the vertexes, the
+    // normal index is the vertex index shifted by normalOffset
+    int normalOffset = _normalCount - _vertexCount;
+    if (hasFaceNormal) {
+        // welded buffers reference one of the axis normals per face
+        if (_axisNormals < 0) {
+            std::string normals;
+            char line[MaxLineSize];
+            for (int f = 0; f < 6; f++)
+                normals.append(line, formatVec3(line, "vn ", NormalFace[f]) - line);
+            addText(blocks, normals);
+            _axisNormals = _normalCount;
+            _normalCount += 6;
+        }
+        normalOffset = _axisNormals + 1;
+    } else if (hasNormal) {
+        for (size_t i = 0; i < buffers.size(); i++) {
+            if (!buffers[i]->hasVertexNormals())
+                continue;
+            int numVertexes = vertexesOffset[i + 1] - vertexesOffset[i];
+            addRanges(blocks, TextBlock::NORMALS, *buffers[i], _triangles ? &triangleLists[i] : nullptr, numVertexes,
+                      0, 0);
+            _normalCount += numVertexes;
+        }
+    }
+
+    // atlas faces reference the texture coordinate of their material
+    if (hasAtlas && _hasPalette && _paletteUVs < 0) {
+        std::string uvs;
+        char line[MaxLineSize];
+        for (int m = 0; m < 256; m++) {
+            char* cursor = line;
+            *cursor++ = 'v';
+            *cursor++ = 't';
+            *cursor++ = ' ';
+            cursor = formatFloat(cursor, paletteU(m));
+            *cursor++ = ' ';
+            cursor = formatFloat(cursor, PaletteV);
+            *cursor++ = '\n';
+            uvs.append(line, cursor - line);
+        }
+        addText(blocks, uvs);
+        _paletteUVs = 1;
+    }
+
+    TextBlock::Type faceType = TextBlock::FACES;
+    if (hasFaceNormal) {
+        faceType = TextBlock::FACES_FACE_NORMAL;
+    } else if (hasNormal) {
+        faceType = TextBlock::FACES_NORMAL;
+    }
+
+    addText(blocks, "\n//Faces " + std::to_string(totalFaces) + "\n");
+    for (size_t i = 0; i < buffers.size(); i++) {
+        const TriangleList* triangles = _triangles ? &triangleLists[i] : nullptr;
+        int uvOffset = -1;
+        if (buffers[i]->hasFaceMaterials() && _hasPalette) {
+            addText(blocks, "g palette\nusemtl palette\n");
+            uvOffset = _paletteUVs;
+        } else {
+            addText(blocks, "g material_" + std::to_string(i) + "\n");
+        }
+        size_t numFaces = triangles ? triangles->faces.size() : buffers[i]->numFaces();
+        addRanges(blocks, faceType, *buffers[i], triangles, numFaces, vertexesOffset[i] + 1, normalOffset, uvOffset);
+    }
+    _vertexCount = vertexesOffset.back();
+
+    writeBlocks(blocks);
+    return !_failed;
+}
+
+void OBJWriter::writeBlocks(const std::vector<TextBlock>& blocks)
+{
+    int window = _threadPool ? _threadPool->size() * BlocksPerThread : 1;
+    _texts.resize(window);
+    for (size_t first = 0; first < blocks.size(); first += window) {
+        int count = first + window < blocks.size() ? window : blocks.size() - first;
+        if (_threadPool) {
+            _threadPool->parallelFor(count, [&](int i) { formatBlock(_texts[i], blocks[first + i]); });
+        } else {
+            for (int i = 0; i < count; i++)
+                formatBlock(_texts[i], blocks[first + i]);
+        }
+
+        for (int i = 0; i < count; i++)
+            _output.write(_texts[i].data(), _texts[i].size());
+    }
+
+    if (_output.failed())
+        _failed = true;
+}
+
+bool OBJWriter::close()
+{
+    if (!_output.isOpen())
+        return !_failed;
+
+    if (!_output.close())
+        _failed = true;
+    std::vector<std::string>().swap(_texts);
+
+    if (_hasPalette && !_failed && !_path.empty()) {
+        std::string mtlPath = sidePath(_path, ".mtl");
+        std::string pngPath = sidePath(_path, ".png");
+        FILE* fp = fopen(mtlPath.c_str(), "w");
+        if (!fp) {
+            logMessage(LOG_ERROR, "Failed to open %s\n", mtlPath.c_str());
+            _failed = true;
+            return false;
+        }
+        fprintf(fp, "newmtl palette\nKa 0 0 0\nKd 1 1 1\nKs 0 0 0\nillum 1\nmap_Kd %s\n", baseName(pngPath).c_str());
+        if (ferror(fp) | fclose(fp))
+            _failed = true;
+        if (!writePNG(pngPath.c_str(), &_palette.colors[0][0], 256, 1))
+            _failed = true;
+    }
+    return !_failed;
+}
+
+MeshWriter* createOBJWriter(ThreadPool* threadPool, bool triangles) { return new OBJWriter(threadPool, triangles); }
+
+int writeOBJ(const VoxelGroup& group, const char* path, ThreadPool* threadPool)
+{
+    OBJWriter writer(threadPool, false);
+    if (!writer.open(path))
+        return 1;
+
+    bool written = writer.write(group, std::string());
+    return writer.close() && written ? 0 : 1;
+}